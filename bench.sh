@@ -0,0 +1,42 @@
+#!/bin/bash
+
+# Build and run the headless renderer benchmark.
+# Results are printed to stdout as JSON; progress goes to stderr.
+#
+# Call like e.g.
+# ./bench.sh -O3
+# ./bench.sh -O3 -- xyz/me109.xyz isphere
+# to pass '-O3' to clang and optionally choose which scenes to run.
+# A scene may be given as e.g. xyz/me109.xyz:focus=1 to focus one of its figures.
+#
+# To see how each stage scales with scene size, profile a sweep of stress scenes:
+# ./bench.sh -O3 -DPROFILE -- stress@polygons=10 stress@polygons=1000 stress@figures=1000,polygons=1000
+
+compile_args=()
+exec_args=()
+
+state=compile_args
+for arg in "$@"; do
+
+  if [ "$arg" = "--" ]; then
+    if [ "$state" = exec_args ]; then
+      echo "Cannot have more than one '--' in arguments" >&2
+      exit
+    fi
+    state=exec_args;
+  else
+
+    if [ "$state" = compile_args ]; then
+      compile_args+=("$arg")
+    else
+      exec_args+=("$arg")
+    fi
+
+  fi
+
+done
+
+command="clang -I./bench/headless -Werror ${compile_args[@]} bench/bench.c -lm -pthread -o bench.out"
+echo "build command: $command" >&2
+eval "$command" || exit
+./bench.out "${exec_args[@]}"
@@ -0,0 +1,210 @@
+// Headless renderer benchmark
+//
+// Renders each scene from a fixed camera orbit and reports per-frame
+// timing statistics as JSON, so that renderer performance can be tracked
+// across versions. Build and run via ./bench.sh from the repository root.
+//
+// Each argument is a scene, given the same way as to the main program.
+// With no arguments, every bundled model and several built-ins are run.
+// Generated scenes of any size, such as stress@figures=1000,polygons=1000,
+// show how rendering scales (see "Stress scenes" in shapes/instances.c).
+//
+// No figure is focused, so all of them are drawn into the cached layer.
+// A scene ending in :focus=N focuses figure N instead, as pressing the
+// number key N does in the main program (0 is the light source, and the
+// scene's figures follow it), e.g. xyz/me109.xyz:focus=1.
+//
+// Built with -DPROFILE, each scene also reports the mean time per frame spent
+// in each stage of rendering, and the mean of each counter. Stages which run
+// on the thread pool report the time summed over its workers.
+
+#include <math.h>
+#include <string.h>
+
+#include <libgfx.h>
+
+#include "../state.c"
+#include "../matrix.c"
+#include "../shapes/figure.c"
+#include "../shapes/v2.c"
+#include "../shapes/instances.c"
+#include "../rendering/draw.c"
+#include "../rendering/render.c"
+#include "../util/misc.c"
+
+const char *default_scenes[] = {
+  "xyz/box123.xyz",
+  "xyz/cylinder.xyz",
+  "xyz/deathstr.xyz",
+  "xyz/ellipsoid.xyz",
+  "xyz/helicop.xyz",
+  "xyz/jvase.xyz",
+  "xyz/me109.xyz",
+  "xyz/sphere.xyz",
+  "xyz/stegsaur.xyz",
+  "xyz/torus2.xyz",
+  "xyz/zylonjag.xyz",
+  "polysphere_1",
+  "isphere",
+  "icyl",
+  "mandelbrot",
+};
+
+// Frames rendered and timed per scene; the orbit makes one full turn over them
+const int bench_frames = 120;
+// Frames rendered before timing starts
+const int warmup_frames = 2;
+
+int Figure_polygon_count(const Figure *figure) {
+  if (figure->kind == fk_Polyhedron) return figure->impl.polyhedron->length;
+  if (figure->kind == fk_MeshInstance) return figure->impl.mesh_instance->mesh->polyhedron->length;
+  return 0;
+}
+
+int scene_split_focus_M(char *name, const size_t name_size, const char *scene) {
+  /* Copy the scene without any :focus=N suffix into name, and return N, or -1 if there's none */
+  const char *suffix = strrchr(scene, ':');
+  int focus_idx = -1;
+  if (suffix == NULL || sscanf(suffix, ":focus=%d", &focus_idx) != 1) suffix = scene + strlen(scene);
+
+  snprintf(name, name_size, "%.*s", (int) (suffix - scene), scene);
+  return focus_idx;
+}
+
+void run_scene(const char *scene, const int is_first) {
+
+  fprintf(stderr, "bench: %s\n", scene);
+
+  char name[256];
+  const int focus_idx = scene_split_focus_M(name, sizeof(name), scene);
+
+  // Same setup as the main program
+  figures = FigureList_new(2);
+  observer = Observer_new();
+
+  light_source = make_small_figure();
+  Figure_move_to(light_source, (v3) { 0, 0, 0 });
+  FigureList_append(figures, light_source);
+
+  if (figures_from_arg(figures, name) == 0) {
+    fprintf(stderr, "Unrecognized path or figure name '%s'\n", name);
+    exit(1);
+  }
+
+  if (focus_idx >= (int) figures->length) {
+    fprintf(stderr, "Cannot focus figure %d of %zu in '%s'\n", focus_idx, figures->length, name);
+    exit(1);
+  }
+  focused_figure = focus_idx >= 0 ? FigureList_get(figures, focus_idx) : NULL;
+
+  int polygon_count = 0;
+  for (int i = 0; i < figures->length; i++) {
+    polygon_count += Figure_polygon_count(FigureList_get(figures, i));
+  }
+
+  // The observer orbits the scene about the vertical axis through its center
+  v3 lows, highs;
+  Figure_bounds_M(&lows, &highs, FigureList_get(figures, 1));
+  for (int i = 2; i < figures->length; i++) {
+    v3 figure_lows, figure_highs;
+    Figure_bounds_M(&figure_lows, &figure_highs, FigureList_get(figures, i));
+    for (int axis = 0; axis < 3; axis++) {
+      lows[axis] = fmin(lows[axis], figure_lows[axis]);
+      highs[axis] = fmax(highs[axis], figure_highs[axis]);
+    }
+  }
+  const v3 center = (lows + highs) / 2;
+  const _Mat to_center = Mat_translate_v(-center);
+  const _Mat from_center = Mat_translate_v(+center);
+  const _Mat rotation = Mat_y_rot(2 * M_PI / bench_frames);
+  _Mat orbit_step;
+  Mat_chain_M(orbit_step, 3, to_center, rotation, from_center);
+
+  for (int frame = 0; frame < warmup_frames; frame++) {
+    render_figures(figures->items, figures->length, focused_figure, observer, light_source);
+  }
+
+  double frame_times[bench_frames];
+  double total = 0;
+
+#ifdef PROFILE
+  double stage_totals[stage_count] = { 0 };
+  double counter_totals[counter_count] = { 0 };
+#endif
+
+  for (int frame = 0; frame < bench_frames; frame++) {
+    Observer_transform(observer, orbit_step);
+
+    const double start = now_seconds();
+    PROFILE_FRAME_BEGIN();
+    render_figures(figures->items, figures->length, focused_figure, observer, light_source);
+    PROFILE_FRAME_END();
+    frame_times[frame] = now_seconds() - start;
+
+    total += frame_times[frame];
+
+#ifdef PROFILE
+    for (int i = 0; i < stage_count; i++) stage_totals[i] += profile_last.stage_seconds[i];
+    for (int i = 0; i < counter_count; i++) counter_totals[i] += profile_last.counters[i];
+#endif
+  }
+
+  qsort(frame_times, bench_frames, sizeof(double), compare_doubles);
+
+  printf("%s\n", is_first ? "" : ",");
+  printf("    {\n");
+  printf("      \"scene\": \"%s\",\n", scene);
+  printf("      \"polygons\": %d,\n", polygon_count);
+  if (focus_idx >= 0) printf("      \"focused_figure\": %d,\n", focus_idx);
+  printf("      \"mean_ms\": %.4f,\n", total / bench_frames * 1000);
+  printf("      \"p50_ms\": %.4f,\n", percentile(frame_times, bench_frames, 50) * 1000);
+  printf("      \"p95_ms\": %.4f,\n", percentile(frame_times, bench_frames, 95) * 1000);
+  printf("      \"p99_ms\": %.4f,\n", percentile(frame_times, bench_frames, 99) * 1000);
+#ifdef PROFILE
+  printf("      \"stages_ms\": {");
+  for (int i = 0; i < stage_count; i++) {
+    printf("%s \"%s\": %.4f", i == 0 ? "" : ",", profile_stage_names[i], stage_totals[i] / bench_frames * 1000);
+  }
+  printf(" },\n");
+  printf("      \"counters\": {");
+  for (int i = 0; i < counter_count; i++) {
+    printf("%s \"%s\": %.1f", i == 0 ? "" : ",", profile_counter_names[i], counter_totals[i] / bench_frames);
+  }
+  printf(" },\n");
+#endif
+  printf("      \"polygons_per_second\": %.1f\n", polygon_count * bench_frames / total);
+  printf("    }");
+  fflush(stdout);
+
+  FigureList_destroy(figures);
+  Observer_destroy(observer);
+  figures = NULL;
+  observer = NULL;
+  light_source = NULL;
+  focused_figure = NULL;
+
+}
+
+int main(const int argc, const char **argv) {
+
+  draw_init();
+
+  const char **scenes = argc > 1 ? argv + 1 : default_scenes;
+  const int scene_count = argc > 1
+    ? argc - 1
+    : (int) (sizeof(default_scenes) / sizeof(default_scenes[0]));
+
+  printf("{\n");
+  printf("  \"frames_per_scene\": %d,\n", bench_frames);
+  printf("  \"screen_width\": %d,\n", SCREEN_WIDTH);
+  printf("  \"screen_height\": %d,\n", SCREEN_HEIGHT);
+  printf("  \"scenes\": [");
+
+  for (int i = 0; i < scene_count; i++) {
+    run_scene(scenes[i], i == 0);
+  }
+
+  printf("\n  ]\n");
+  printf("}\n");
+
+}
@@ -0,0 +1,24 @@
+#ifndef headless_libgfx_h_INCLUDED
+#define headless_libgfx_h_INCLUDED
+
+// Stand-in for libgfx/libgfx.h used by the benchmark.
+// Everything the renderer would send to the X11 window is dropped,
+// so benchmarks measure only our own code and need no display.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+static inline int G_init_graphics(double w, double h) { return 1; }
+static inline int G_close() { return 1; }
+static inline int G_rgb(double r, double g, double b) { return 1; }
+static inline int G_clear() { return 1; }
+static inline int G_point(double x, double y) { return 1; }
+static inline int G_fill_rectangle(double x, double y, double w, double h) { return 1; }
+static inline int G_draw_string(const char *s, double x, double y) { return 1; }
+static inline int G_display_image() { return 1; }
+static inline int G_wait_key() { return 'e'; }
+static inline int G_no_wait_key() { return -1; }
+
+#endif // headless_libgfx_h_INCLUDED
@@ -1,5 +1,5 @@
 #!/bin/bash
-command="clang -I./libgfx -Werror $@ main.c ./libgfx/*.o -lm -lX11"
+command="clang -I./libgfx -Werror $@ main.c ./libgfx/*.o -lm -lX11 -pthread"
 echo "build command: $command"
 eval "$command"
 
@@ -16,6 +16,7 @@ typedef enum {
   param_SPECULAR_POWER,
   param_HITHER,
   param_YON,
+  param_SAMPLING_TOLERANCE,
 } Parameter;
 
 Parameter selected_parameter = param_HALF_ANGLE;
@@ -60,7 +61,37 @@ _Mat rotate_y_negative;
 _Mat rotate_z_positive;
 _Mat rotate_z_negative;
 
+// Transformations of the focused figure are folded into one matrix and
+// applied all at once by flush_transforms, so that a burst of input costs
+// a single pass over the figure's geometry
+_Mat pending_transform = Mat_identity();
+Figure *pending_figure = NULL;
+int has_pending_transform = 0;
+
+void flush_transforms();
+
+void queue_transform(const _Mat transformation) {
+  if (pending_figure != focused_figure) flush_transforms();
+  pending_figure = focused_figure;
+  Mat_mult_M(pending_transform, transformation, pending_transform);
+  has_pending_transform = 1;
+}
+
+void flush_transforms() {
+  // Moving a figure of the scene moves its node, and so everything beneath it too
+  if (has_pending_transform && !Scene_transform_figure(scene, pending_figure, pending_transform)) {
+    Figure_transform(pending_figure, pending_transform);
+  }
+
+  const _Mat id = Mat_identity();
+  Mat_clone_M(pending_transform, id);
+  pending_figure = NULL;
+  has_pending_transform = 0;
+}
+
 void make_dependent_movements(Figure *figure) {
+  // Sizes are measured on the figure as last flushed,
+  // which is only off after pending rotations or scaling
   const v3 sizes = Figure_size(figure);
 
   { const _Mat m = Mat_translate(0, 0, -rel_speed * sizes[0]); Mat_clone_M(translate_backwards_rel, m); }
@@ -70,7 +101,11 @@ void make_dependent_movements(Figure *figure) {
   { const _Mat m = Mat_translate(0, +rel_speed * sizes[2], 0); Mat_clone_M(translate_up_rel       , m); }
   { const _Mat m = Mat_translate(0, -rel_speed * sizes[2], 0); Mat_clone_M(translate_down_rel     , m); }
 
-  const v3 figure_center = Figure_center(figure);
+  // Carry the center through any pending transformation
+  // so that rotations and scaling stay about the right point
+  const v3 figure_center = pending_figure == figure
+    ? v3_transform(Figure_center(figure), pending_transform)
+    : Figure_center(figure);
   { const _Mat m = Mat_translate_v(-figure_center); Mat_clone_M(translate_to_origin  , m); }
   { const _Mat m = Mat_translate_v(+figure_center); Mat_clone_M(translate_from_origin, m); }
 
@@ -126,6 +161,13 @@ void on_key(const char key) {
     case '%': DO_HALO                 = !DO_HALO;                 break;
     case '^': DO_CLIPPING             = !DO_CLIPPING;             break;
     case '&': DO_BOUNDING_BOXES       = !DO_BOUNDING_BOXES;       break;
+    case '*': DO_OCCLUSION_CULLING    = !DO_OCCLUSION_CULLING;    break;
+    case ')': DO_DAMAGE_TRACKING      = !DO_DAMAGE_TRACKING;      break;
+    case '|': DO_PARALLEL_RENDER      = !DO_PARALLEL_RENDER;      break;
+    case '~': DO_ADAPTIVE_SAMPLING    = !DO_ADAPTIVE_SAMPLING;    break;
+    case '\\': DO_EDGE_RASTER         = !DO_EDGE_RASTER;          break;
+    case ';': DO_DEFERRED_SHADING     = !DO_DEFERRED_SHADING;     break;
+    case '(': heatmap_mode = (heatmap_mode + 1) % heatmap_mode_count; break;
 
     case '/': BACKFACE_ELIMINATION_SIGN *= -1; break;
     case '`': render_overlay = !render_overlay; break;
@@ -136,6 +178,7 @@ void on_key(const char key) {
     case 'P': selected_parameter = param_SPECULAR_POWER; break;
     case 'T': selected_parameter = param_HITHER;         break;
     case 'Y': selected_parameter = param_YON;            break;
+    case 'E': selected_parameter = param_SAMPLING_TOLERANCE; break;
   }
 
   if (key == '=' || key == '-' || key == '+' || key == '_') {
@@ -143,6 +186,11 @@ void on_key(const char key) {
     const int is_fast = key == '+' || key == '_';
 
     switch(selected_parameter) {
+    case param_SAMPLING_TOLERANCE:
+      SAMPLING_TOLERANCE += sign * (is_fast ? 0.05 : 0.005);
+      if (SAMPLING_TOLERANCE < 0) SAMPLING_TOLERANCE = 0;
+      break;
+
     case param_HALF_ANGLE    : HALF_ANGLE     += sign * (is_fast ? 0.50 : 0.01);
     case param_AMBIENT       : AMBIENT        += sign * (is_fast ? 0.5  : 0.05);
     case param_DIFFUSE_MAX   : DIFFUSE_MAX    += sign * (is_fast ? 0.5  : 0.05);
@@ -165,12 +213,12 @@ void on_key(const char key) {
   switch(key) {
 
     // Figure-independent movements
-    case 'W': Figure_transform(focused_figure, translate_forwards_abs ); break;
-    case 'S': Figure_transform(focused_figure, translate_backwards_abs); break;
-    case 'D': Figure_transform(focused_figure, translate_right_abs    ); break;
-    case 'A': Figure_transform(focused_figure, translate_left_abs     ); break;
-    case 'F': Figure_transform(focused_figure, translate_down_abs     ); break;
-    case 'R': Figure_transform(focused_figure, translate_up_abs       ); break;
+    case 'W': queue_transform(translate_forwards_abs ); break;
+    case 'S': queue_transform(translate_backwards_abs); break;
+    case 'D': queue_transform(translate_right_abs    ); break;
+    case 'A': queue_transform(translate_left_abs     ); break;
+    case 'F': queue_transform(translate_down_abs     ); break;
+    case 'R': queue_transform(translate_up_abs       ); break;
 
     // Figure-dependent movements
     case 'w':
@@ -190,28 +238,29 @@ void on_key(const char key) {
     case 'O':
       make_dependent_movements(focused_figure);
       switch(key) {
-        case 'w': Figure_transform(focused_figure, translate_forwards_rel ); break;
-        case 's': Figure_transform(focused_figure, translate_backwards_rel); break;
-        case 'd': Figure_transform(focused_figure, translate_right_rel    ); break;
-        case 'a': Figure_transform(focused_figure, translate_left_rel     ); break;
-        case 'f': Figure_transform(focused_figure, translate_down_rel     ); break;
-        case 'r': Figure_transform(focused_figure, translate_up_rel       ); break;
-
-        case 'o': Figure_transform(focused_figure, rotate_x_positive  ); break;
-        case 'p': Figure_transform(focused_figure, rotate_x_negative  ); break;
-        case 'k': Figure_transform(focused_figure, rotate_y_positive  ); break;
-        case 'l': Figure_transform(focused_figure, rotate_y_negative  ); break;
-        case 'm': Figure_transform(focused_figure, rotate_z_positive  ); break;
-        case ',': Figure_transform(focused_figure, rotate_z_negative  ); break;
-
-        case '[': Figure_transform(focused_figure, scale_down         ); break;
-        case ']': Figure_transform(focused_figure, scale_up           ); break;
-
-        case 'O': Figure_transform(focused_figure, translate_to_origin); break;
+        case 'w': queue_transform(translate_forwards_rel ); break;
+        case 's': queue_transform(translate_backwards_rel); break;
+        case 'd': queue_transform(translate_right_rel    ); break;
+        case 'a': queue_transform(translate_left_rel     ); break;
+        case 'f': queue_transform(translate_down_rel     ); break;
+        case 'r': queue_transform(translate_up_rel       ); break;
+
+        case 'o': queue_transform(rotate_x_positive  ); break;
+        case 'p': queue_transform(rotate_x_negative  ); break;
+        case 'k': queue_transform(rotate_y_positive  ); break;
+        case 'l': queue_transform(rotate_y_negative  ); break;
+        case 'm': queue_transform(rotate_z_positive  ); break;
+        case ',': queue_transform(rotate_z_negative  ); break;
+
+        case '[': queue_transform(scale_down         ); break;
+        case ']': queue_transform(scale_up           ); break;
+
+        case 'O': queue_transform(translate_to_origin); break;
       }
       break;
 
     case 'L': ;
+      flush_transforms();
       const v3 figure_center = Figure_center(focused_figure);
       printf("Object at (%f, %f, %f)\n", figure_center[0], figure_center[1], figure_center[2]);
       break;
@@ -256,11 +305,73 @@ void on_key(const char key) {
   }
 
 
+void display_heatmap_legend() {
+  /* Draw the color ramp of the current heatmap and what its ends mean */
+  const int x = SCREEN_WIDTH - 200;
+  const int y = 20;
+  const int width = 160;
+
+  for (int i = 0; i < width; i++) {
+    G_rgbv(heat_color((float) i / (width - 1)));
+    G_fill_rectangle(x + i, y + 20, 1, 10);
+  }
+
+  G_rgb(1, 1, 1);
+  draw_stringf(x, y + 40, "(() Heat: %s            ", heatmap_mode_names[heatmap_mode]);
+
+  switch (heatmap_mode) {
+    case heatmap_overdraw:
+      draw_stringf(x, y, "1");
+      draw_stringf(x + width - 20, y, "%d+", heatmap_count_max);
+      break;
+    case heatmap_depth_fail:
+      draw_stringf(x, y, "0");
+      draw_stringf(x + width - 20, y, "%d+", heatmap_count_max);
+      break;
+    case heatmap_cost:
+      draw_stringf(x, y, "0 ms");
+      draw_stringf(x + width - 60, y, "%.2f ms     ", heatmap_max_seconds * 1000);
+      break;
+    default:
+      break;
+  }
+}
+
 void display_state() {
+  if (heatmap_mode != heatmap_off) display_heatmap_legend();
+
   G_rgb(1, 1, 1);
   draw_stringf(20, SCREEN_HEIGHT -  40, "(`) Overlay: %d", render_overlay);
   if (!render_overlay) return;
 
+  draw_stringf(SCREEN_WIDTH - 200, SCREEN_HEIGHT - 40, "Frame: %.1f ms        ", frame_time * 1000);
+  // Over the frames presented since input last paused
+  const double fps = presents_per_second();
+  if (fps > 0) {
+    draw_stringf(SCREEN_WIDTH - 200, SCREEN_HEIGHT - 60, "FPS  : %.1f        ", fps);
+  } else {
+    draw_stringf(SCREEN_WIDTH - 200, SCREEN_HEIGHT - 60, "FPS  : -           ");
+  }
+
+#ifdef PROFILE
+  // Stats of the last complete frame
+  {
+    int lly = SCREEN_HEIGHT - 100;
+    double accounted = 0;
+    for (int i = 0; i < stage_count; i++) {
+      draw_stringf(SCREEN_WIDTH - 200, lly, "%-9s: %.2f ms        ", profile_stage_names[i], profile_last.stage_seconds[i] * 1000);
+      accounted += profile_last.stage_seconds[i];
+      lly -= 20;
+    }
+    draw_stringf(SCREEN_WIDTH - 200, lly, "%-9s: %.2f ms        ", "other", (profile_last.total_seconds - accounted) * 1000);
+    lly -= 40;
+
+    draw_stringf(SCREEN_WIDTH - 200, lly, "Clipped: %ld        ", profile_last.counters[counter_polygons_clipped]);
+    draw_stringf(SCREEN_WIDTH - 200, lly - 20, "Culled : %ld        ", profile_last.counters[counter_polygons_culled]);
+    draw_stringf(SCREEN_WIDTH - 200, lly - 40, "Pixels : %ld        ", profile_last.counters[counter_pixels_written]);
+  }
+#endif
+
   draw_stringf(20, SCREEN_HEIGHT -  80, "(!) Wframe: %d", DO_WIREFRAME);
   draw_stringf(20, SCREEN_HEIGHT - 100, "(@) BFElim: %d", DO_BACKFACE_ELIMINATION);
   draw_stringf(20, SCREEN_HEIGHT - 120, "(/)   Sign: %d", BACKFACE_ELIMINATION_SIGN);
@@ -269,8 +380,22 @@ void display_state() {
   draw_stringf(20, SCREEN_HEIGHT - 180, "(%%) Halos : %d", DO_HALO);
   draw_stringf(20, SCREEN_HEIGHT - 200, "(^) Clip  : %d", DO_CLIPPING);
   draw_stringf(20, SCREEN_HEIGHT - 220, "(&) Boxes : %d", DO_BOUNDING_BOXES);
-
-  draw_stringf(20, 140, "Use +/- to adjust ");
+  draw_stringf(20, SCREEN_HEIGHT - 240, "(*) Occl  : %d", DO_OCCLUSION_CULLING);
+  draw_stringf(20, SCREEN_HEIGHT - 260, "()) Damage: %d", DO_DAMAGE_TRACKING);
+  draw_stringf(20, SCREEN_HEIGHT - 280, "(|) Thread: %d", DO_PARALLEL_RENDER);
+  draw_stringf(20, SCREEN_HEIGHT - 300, "(~) Adapt : %d", DO_ADAPTIVE_SAMPLING);
+
+  draw_stringf(20, SCREEN_HEIGHT - 320, "(\\) Edges : %d", DO_EDGE_RASTER);
+  draw_stringf(20, SCREEN_HEIGHT - 340, "(;) Defer : %d", DO_DEFERRED_SHADING);
+
+  draw_stringf(20, SCREEN_HEIGHT - 360, "Occluded figs : %d        ", occluded_figure_count);
+  draw_stringf(20, SCREEN_HEIGHT - 380, "Occluded polys: %d        ", occluded_polygon_count);
+  draw_stringf(20, SCREEN_HEIGHT - 400, "Redrawn pixels: %ld        ", redrawn_pixel_count);
+  draw_stringf(20, SCREEN_HEIGHT - 420, "  in layer    : %ld        ", redrawn_layer_pixel_count);
+  draw_stringf(20, SCREEN_HEIGHT - 440, "Culled figs   : %d        ", culled_figure_count);
+
+  draw_stringf(20, 160, "Use +/- to adjust ");
+  draw_param(20, 140, "E", param_SAMPLING_TOLERANCE, "Toler  : %lf      ", SAMPLING_TOLERANCE);
   draw_param(20, 120, "H", param_HALF_ANGLE    , "HAngle : %lf      ", HALF_ANGLE);
   draw_param(20, 100, "B", param_AMBIENT       , "Ambient: %lf      ", AMBIENT);
   draw_param(20,  80, "M", param_DIFFUSE_MAX   , "DifMax : %lf      ", DIFFUSE_MAX);
@@ -279,10 +404,13 @@ void display_state() {
   draw_param(20,  20, "Y", param_YON           , "Yon    : %lf      ", YON);
 
   // Draw indices for each figure
+  _Mat to_eyespace;
+  calc_eyespace_matrix_M(to_eyespace, observer);
+
   for (int figure_i = 0; figure_i < figures->length; figure_i++) {
     const Figure *figure = FigureList_get(figures, figure_i);
 
-    const v3 center = Figure_center(figure);
+    const v3 center = v3_transform(Figure_center(figure), to_eyespace);
     const v2 pixel = pixel_coords(center);
 
     // TODO: better way to show off-bounds objects
@@ -316,6 +444,13 @@ void show_help() {
   printf("  /    - Change backface elimination sign\n");
   printf("  ^    - Enable/disable clipping\n");
   printf("  &    - Enable/disable bounding boxes\n");
+  printf("  *    - Enable/disable occlusion culling\n");
+  printf("  )    - Enable/disable damage tracking\n");
+  printf("  |    - Enable/disable rendering on several threads\n");
+  printf("  ~    - Enable/disable adaptive sampling of intersectors\n");
+  printf("  \\    - Enable/disable filling polygons by edge functions\n");
+  printf("  ;    - Enable/disable deferred shading of the figures not selected\n");
+  printf("  (    - Cycle heatmaps: off, overdraw, depth fails, figure cost\n");
   printf("\n");
   printf("Scalar parameters:\n");
   printf("  -+   - Adjust parameter (use shift for fast)\n");
@@ -325,6 +460,7 @@ void show_help() {
   printf("  P    - Select parameter SPECULAR_POWER\n");
   printf("  T    - Select parameter HITHER\n");
   printf("  Y    - Select parameter YON\n");
+  printf("  E    - Select parameter SAMPLING_TOLERANCE\n");
   printf("\n");
 }
 
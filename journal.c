@@ -0,0 +1,162 @@
+#ifndef journal_c_INCLUDED
+#define journal_c_INCLUDED
+
+// Input journals, for turning interactive sessions into
+// reproducible performance tests.
+//
+// Running with `--record <file>` writes the scene and every key handled
+// by on_key to <file>. Running with `--replay <file>` loads that scene,
+// feeds the keys back through on_key one at a time as fast as possible,
+// rendering after each, and reports frame-time statistics per key.
+//
+// A journal is plain text with one entry per line:
+//   scene <arg>             a figure, as given on the command line
+//   key <seconds> <code>    a key code, and when it was pressed
+//                           (in seconds since recording began)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/misc.c"
+#include "util/dyn.c"
+
+DYN_INIT(JournalScenes, char*);
+DYN_INIT(JournalKeys, int);
+DYN_INIT(FrameTimes, double);
+
+
+// == Recording == //
+
+FILE *journal_file = NULL;
+double journal_start;
+
+void journal_open(const char *path, const char **scene_args, const int scene_count) {
+  journal_file = fopen(path, "w");
+  if (journal_file == NULL) {
+    printf("Cannot open journal %s\n", path);
+    exit(1);
+  }
+
+  journal_start = now_seconds();
+  for (int i = 0; i < scene_count; i++) {
+    fprintf(journal_file, "scene %s\n", scene_args[i]);
+  }
+  fflush(journal_file);
+}
+
+void journal_key(const int key) {
+  if (journal_file == NULL) return;
+  fprintf(journal_file, "key %f %d\n", now_seconds() - journal_start, key);
+  // Flush every key so that a crash still leaves a usable journal
+  fflush(journal_file);
+}
+
+void journal_close() {
+  if (journal_file == NULL) return;
+  fclose(journal_file);
+  journal_file = NULL;
+}
+
+
+// == Replaying == //
+
+typedef struct {
+  JournalScenes *scenes;
+  JournalKeys *keys;
+} Journal;
+
+void Journal_load(Journal *journal, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    printf("Cannot open journal %s\n", path);
+    exit(1);
+  }
+
+  journal->scenes = JournalScenes_new(4);
+  journal->keys = JournalKeys_new(256);
+
+  char word[16];
+  while (fscanf(file, "%15s", word) == 1) {
+    if (strcmp(word, "scene") == 0) {
+      char arg[1024];
+      if (fscanf(file, " %1023s", arg) != 1) break;
+      JournalScenes_append(journal->scenes, strdup(arg));
+    } else if (strcmp(word, "key") == 0) {
+      double seconds;
+      int key;
+      if (fscanf(file, "%lf %d", &seconds, &key) != 2) break;
+      JournalKeys_append(journal->keys, key);
+    } else {
+      printf("Malformed journal %s: unexpected '%s'\n", path, word);
+      exit(1);
+    }
+  }
+
+  fclose(file);
+}
+
+void Journal_destroy(Journal *journal) {
+  for (int i = 0; i < journal->scenes->length; i++) {
+    free(JournalScenes_get(journal->scenes, i));
+  }
+  Dyn_destroy(journal->scenes);
+  Dyn_destroy(journal->keys);
+}
+
+// Frame times of replayed frames, by the key which caused them
+FrameTimes *replay_times[256];
+
+void replay_record_frame(const int key, const double seconds) {
+  const unsigned char code = key;
+  if (replay_times[code] == NULL) replay_times[code] = FrameTimes_new(16);
+  FrameTimes_append(replay_times[code], seconds);
+}
+
+void replay_print_key_stats(const char *label, FrameTimes *times) {
+  double *sorted = times->items;
+  qsort(sorted, times->length, sizeof(double), compare_doubles);
+
+  double total = 0;
+  for (int i = 0; i < times->length; i++) total += sorted[i];
+
+  printf("%-8s %6zu %10.3f %10.3f %10.3f %10.3f\n",
+    label,
+    times->length,
+    total / times->length * 1000,
+    percentile(sorted, times->length, 50) * 1000,
+    percentile(sorted, times->length, 95) * 1000,
+    sorted[times->length - 1] * 1000
+  );
+}
+
+void replay_print_report() {
+  printf("%-8s %6s %10s %10s %10s %10s\n", "key", "frames", "mean_ms", "p50_ms", "p95_ms", "max_ms");
+
+  FrameTimes *all = FrameTimes_new(256);
+
+  for (int code = 0; code < 256; code++) {
+    FrameTimes *times = replay_times[code];
+    if (times == NULL) continue;
+
+    for (int i = 0; i < times->length; i++) {
+      FrameTimes_append(all, FrameTimes_get(times, i));
+    }
+
+    char label[16];
+    if (code > ' ' && code < 127) {
+      snprintf(label, sizeof(label), "'%c'", code);
+    } else {
+      snprintf(label, sizeof(label), "%d", code);
+    }
+    replay_print_key_stats(label, times);
+
+    Dyn_destroy(times);
+    replay_times[code] = NULL;
+  }
+
+  if (all->length > 0) replay_print_key_stats("all", all);
+  Dyn_destroy(all);
+}
+
+#endif // journal_c_INCLUDED
@@ -9,19 +9,8 @@
 #include "shapes/instances.c"
 #include "rendering/draw.c"
 #include "rendering/render.c"
-
-void FigureList_destroy(FigureList *figures) {
-  for (int polyhedron_idx = 0; polyhedron_idx < figures->length; polyhedron_idx++) {
-    Figure_destroy(FigureList_get(figures, polyhedron_idx));
-  }
-  Dyn_destroy(figures);
-}
-
-float clamp(float x, float lo, float hi) {
-  if (x < lo) return lo;
-  if (x > hi) return hi;
-  return x;
-}
+#include "scene.c"
+#include "util/misc.c"
 
 void draw_box() {
   G_fill_rectangle(0               , 0                , SCREEN_WIDTH, 1            );
@@ -30,24 +19,145 @@ void draw_box() {
   G_fill_rectangle(0               , 0                , 1           , SCREEN_HEIGHT);
 }
 
+// Frames are rendered at most this often; input arriving
+// in between is folded into the next frame
+const double frame_period = 1.0 / 60;
+// Duration of the last rendered frame, in seconds
+double frame_time = 0;
+
+// Times between the last few frames presented by the event loop, in seconds.
+// The FPS shown is one over their mean. A gap longer than present_idle_gap
+// means the loop sat idle waiting for input, and starts the history again.
+#define PRESENT_INTERVAL_COUNT 16
+const double present_idle_gap = 0.5;
+double present_intervals[PRESENT_INTERVAL_COUNT];
+// Intervals recorded, up to PRESENT_INTERVAL_COUNT, and where the next goes
+int present_interval_count = 0;
+int present_interval_next = 0;
+double last_present = -1;
+
+void record_present(const double time) {
+  /* Note that a frame was presented at the given time */
+  const double interval = time - last_present;
+  last_present = time;
+
+  if (interval > present_idle_gap) {
+    present_interval_count = 0;
+    present_interval_next = 0;
+    return;
+  }
+
+  present_intervals[present_interval_next] = interval;
+  present_interval_next = (present_interval_next + 1) % PRESENT_INTERVAL_COUNT;
+  if (present_interval_count < PRESENT_INTERVAL_COUNT) present_interval_count++;
+}
+
+double presents_per_second() {
+  /* Frames presented per second, over the recorded intervals, or 0 if there are none */
+  if (present_interval_count == 0) return 0;
+
+  double total = 0;
+  for (int i = 0; i < present_interval_count; i++) total += present_intervals[i];
+  return present_interval_count / total;
+}
+
 #include "controls.c"
 
+// How long to sleep between polls when nothing has changed
+const double idle_period = 1.0 / 250;
+
+int poll_key() {
+  /* Return the next pending key without blocking, or 0 if there is none */
+  const int key = G_no_wait_key();
+  return key > 0 ? key : 0;
+}
+
+void render_frame() {
+  const double start = now_seconds();
+  PROFILE_FRAME_BEGIN();
+
+  // Clear screen
+  G_rgb(0, 0, 0);
+  G_clear();
+  G_rgb(1, 0, 0);
+  draw_box();
+
+  // Figures of the scene which are out of view are marked, and left out by render_figures
+  if (scene != NULL) Scene_cull(scene, observer);
+
+  render_figures(figures->items, figures->length, focused_figure, observer, light_source);
+  display_state();
+
+  PROFILE_BEGIN(stage_present);
+  G_display_image();
+  PROFILE_END(stage_present);
+
+  PROFILE_FRAME_END();
+  frame_time = now_seconds() - start;
+}
+
+#include "journal.c"
+
+void handle_key(const int key) {
+  journal_key(key);
+  on_key(key);
+}
+
 void event_loop() {
 
-  char key = '1';
-  do {
+  handle_key('1');
+  flush_transforms();
+  render_frame();
+  record_present(now_seconds());
+
+  while (1) {
+    const double frame_start = now_seconds();
+
+    // Drain all pending input
+    int changed = 0;
+    int key;
+    while ((key = poll_key()) != 0) {
+      if (key == 'e') return;
+      handle_key(key);
+      changed = 1;
+    }
+
+    if (!changed) {
+      sleep_seconds(idle_period);
+      continue;
+    }
+
+    flush_transforms();
+    render_frame();
+    record_present(now_seconds());
+
+    sleep_seconds(frame_period - (now_seconds() - frame_start));
+  }
+}
+
+void replay(const Journal *journal) {
+  /* Replay a journal's keys as fast as possible, with one frame per key */
+  render_frame();
 
-    // Clear screen
-    G_rgb(0, 0, 0);
-    G_clear();
-    G_rgb(1, 0, 0);
-    draw_box();
+  for (int i = 0; i < journal->keys->length; i++) {
+    const int key = JournalKeys_get(journal->keys, i);
 
+    const double start = now_seconds();
     on_key(key);
-    render_figures(figures->items, figures->length, focused_figure, observer, light_source);
-    display_state();
+    flush_transforms();
+    render_frame();
+    replay_record_frame(key, now_seconds() - start);
+  }
 
-  } while ((key = G_wait_key()) != 'e');
+  replay_print_report();
+}
+
+void add_figures(const char *arg) {
+  const int added = is_scene_path(arg) ? scene_load(figures, arg) : figures_from_arg(figures, arg);
+  if (added == 0) {
+    printf("Unrecognized path or figure name '%s'\n", arg);
+    exit(1);
+  }
 }
 
 int main(const int argc, const char **argv) {
@@ -68,40 +178,45 @@ int main(const int argc, const char **argv) {
   FigureList_append(figures, light_source);
 
   // Parse command-line args
+  const char *record_path = NULL;
+  const char *replay_path = NULL;
+  const char *scene_args[argc];
+  int scene_count = 0;
+
   for (int i = 1; i < argc; i++) {
     const char *arg = argv[i];
-    const int is_path = strchr(arg, '/') != NULL;
 
-    Figure *figure;
-
-    if (is_path) {
-      // load a polyhedron from a filname
-      const char *filename = arg;
-      Polyhedron *polyhedron = load_polyhedron(filename);
-      figure = Figure_from_Polyhedron(polyhedron);
-      nicely_place_figure(figure);
+    if (strcmp(arg, "--record") == 0 && i + 1 < argc) {
+      record_path = argv[++i];
+    } else if (strcmp(arg, "--replay") == 0 && i + 1 < argc) {
+      replay_path = argv[++i];
     } else {
-      // get a premade figure
-      const char *key = arg;
-      figure = figure_instance_lookup(key);
-
-      if (figure == NULL) {
-        printf("Unrecognized path or figure name '%s'\n", arg);
-        exit(1);
-      }
+      scene_args[scene_count++] = arg;
+      add_figures(arg);
     }
-
-    FigureList_append(figures, figure);
   }
 
   // == Main == //
 
-  event_loop();
+  if (replay_path != NULL) {
+    Journal journal;
+    Journal_load(&journal, replay_path);
+    for (int i = 0; i < journal.scenes->length; i++) {
+      add_figures(JournalScenes_get(journal.scenes, i));
+    }
+
+    replay(&journal);
+    Journal_destroy(&journal);
+  } else {
+    if (record_path != NULL) journal_open(record_path, scene_args, scene_count);
+    event_loop();
+    journal_close();
+  }
 
   // == Teardown == //
 
+  if (scene != NULL) Scene_destroy(scene);
   FigureList_destroy(figures);
-  draw_close();
   G_close();
 
 }
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <math.h>
 #include <stdarg.h>
+#include <string.h>
 
 // Define the matrix type.
 // The underscore before it is meant
@@ -174,45 +175,144 @@ void Mat_adj_M(_Mat result, const _Mat m) {
 
 }
 
+// A matrix row, for SIMD arithmetic. Rows of a _Mat needn't be
+// aligned, so they are moved in and out with memcpy, which the
+// compiler turns into unaligned vector loads and stores.
+typedef float _MatRow __attribute__((vector_size(4 * sizeof(float))));
+
+static inline _MatRow Mat_row(const _Mat m, const int i) {
+  _MatRow row;
+  memcpy(&row, m[i], sizeof(_MatRow));
+  return row;
+}
+
+static inline void Mat_set_row(_Mat m, const int i, const _MatRow row) {
+  memcpy(m[i], &row, sizeof(_MatRow));
+}
+
+int Mat_is_affine(const _Mat m) {
+  /* Is the bottom row that of an affine transform, (0 0 0 1)? */
+  return m[3][0] == 0 && m[3][1] == 0 && m[3][2] == 0 && m[3][3] == 1;
+}
+
+void Mat_inv_affine_M(_Mat result, const _Mat m) {
+  // Invert an affine transform, i.e.
+  //   ( A  t )^-1  =  ( A^-1  -A^-1 t )
+  //   ( 0  1 )        ( 0      1      )
+  // where the 3x3 inverse is found by cofactors
+  // result may be m
+
+  const float a = m[0][0], b = m[0][1], c = m[0][2], tx = m[0][3];
+  const float d = m[1][0], e = m[1][1], f = m[1][2], ty = m[1][3];
+  const float g = m[2][0], h = m[2][1], i = m[2][2], tz = m[2][3];
+
+  const float c00 = e * i - f * h;
+  const float c01 = f * g - d * i;
+  const float c02 = d * h - e * g;
+  const float inv_det = 1 / (a * c00 + b * c01 + c * c02);
+
+  const float r00 = c00 * inv_det, r01 = (c * h - b * i) * inv_det, r02 = (b * f - c * e) * inv_det;
+  const float r10 = c01 * inv_det, r11 = (a * i - c * g) * inv_det, r12 = (c * d - a * f) * inv_det;
+  const float r20 = c02 * inv_det, r21 = (b * g - a * h) * inv_det, r22 = (a * e - b * d) * inv_det;
+
+  result[0][0] = r00; result[0][1] = r01; result[0][2] = r02; result[0][3] = -(r00 * tx + r01 * ty + r02 * tz);
+  result[1][0] = r10; result[1][1] = r11; result[1][2] = r12; result[1][3] = -(r10 * tx + r11 * ty + r12 * tz);
+  result[2][0] = r20; result[2][1] = r21; result[2][2] = r22; result[2][3] = -(r20 * tx + r21 * ty + r22 * tz);
+  result[3][0] = 0  ; result[3][1] = 0  ; result[3][2] = 0  ; result[3][3] = 1;
+}
+
+void Mat_inv_rigid_M(_Mat result, const _Mat m) {
+  // Invert a rotation followed by a translation. The rotation's
+  // inverse is its transpose, so
+  //   ( R  t )^-1  =  ( R^T  -R^T t )
+  //   ( 0  1 )        ( 0     1     )
+  // result may be m
+
+  const float r00 = m[0][0], r01 = m[1][0], r02 = m[2][0];
+  const float r10 = m[0][1], r11 = m[1][1], r12 = m[2][1];
+  const float r20 = m[0][2], r21 = m[1][2], r22 = m[2][2];
+  const float tx = m[0][3], ty = m[1][3], tz = m[2][3];
+
+  result[0][0] = r00; result[0][1] = r01; result[0][2] = r02; result[0][3] = -(r00 * tx + r01 * ty + r02 * tz);
+  result[1][0] = r10; result[1][1] = r11; result[1][2] = r12; result[1][3] = -(r10 * tx + r11 * ty + r12 * tz);
+  result[2][0] = r20; result[2][1] = r21; result[2][2] = r22; result[2][3] = -(r20 * tx + r21 * ty + r22 * tz);
+  result[3][0] = 0  ; result[3][1] = 0  ; result[3][2] = 0  ; result[3][3] = 1;
+}
+
 void Mat_inv_M(_Mat result, const _Mat m) {
-  Mat_adj_M(result, m);
-  Mat_scale(result, 1 / Mat_det(m));
+  // Nearly every matrix here is affine, and those
+  // have a much cheaper inverse than the general one
+  if (Mat_is_affine(m)) {
+    Mat_inv_affine_M(result, m);
+    return;
+  }
+
+  _Mat adj;
+  Mat_adj_M(adj, m);
+  Mat_scale(adj, 1 / Mat_det(m));
+  Mat_clone_M(result, adj);
 }
 
 void Mat_mult_M(_Mat result, const _Mat a, const _Mat b) {
   // result = a * b
-  // this is SAFE, i.e. the user can make a call such as 
+  // this is SAFE, i.e. the user can make a call such as
   // M2d_mat_mult(p,  p,q) or M2d_mat_mult(p,  q,p) or  M2d_mat_mult(p, p,p)
-  _Mat u;
-  Mat_clone_M(u, a);
-  _Mat v;
-  Mat_clone_M(v, b);
-
-  for(int i = 0; i < 4; i++) {
-    for(int j = 0; j < 4; j++) {
-      result[i][j] = u[i][0] * v[0][j]
-                   + u[i][1] * v[1][j]
-                   + u[i][2] * v[2][j]
-                   + u[i][3] * v[3][j];
-    }
+  // since all of b is read before anything is written, and each
+  // row of a is read before the same row of result is written
+
+  const _MatRow b0 = Mat_row(b, 0);
+  const _MatRow b1 = Mat_row(b, 1);
+  const _MatRow b2 = Mat_row(b, 2);
+  const _MatRow b3 = Mat_row(b, 3);
+
+  for (int i = 0; i < 4; i++) {
+    const _MatRow row = Mat_row(a, i);
+    Mat_set_row(result, i, row[0] * b0 + row[1] * b1 + row[2] * b2 + row[3] * b3);
   }
 }
 
+void Mat_then_M(_Mat result, const _Mat m) {
+  // result = m * result, i.e. apply m after result
+  Mat_mult_M(result, m, result);
+}
+
 void Mat_chain_M(_Mat result, const int count, ...) {
-  // Mat_chain(r, a, b, c) makes r = c*b*a*I
+  // Mat_chain(r, a, b, c) makes r = c*b*a
 
   va_list args;
   va_start(args, count);
 
-  const _Mat id = Mat_identity();
-  Mat_clone_M(result, id);
+  if (count == 0) {
+    const _Mat id = Mat_identity();
+    Mat_clone_M(result, id);
+  }
 
   for (int i = 0; i < count; i++) {
-    float (*mat)[] = va_arg(args, float(*)[]);
-    Mat_mult_M(result, mat, result);
+    float (*mat)[4] = va_arg(args, float(*)[4]);
+    if (i == 0) Mat_clone_M(result, mat);
+    else Mat_then_M(result, mat);
   }
 
   va_end(args);
 }
 
+void Mat_normal_M(_Mat result, const _Mat m) {
+  // The matrix which transforms normals along with m:
+  // the inverse transpose of its linear part.
+  // For a rigid transform that's just the rotation.
+  // result may be m
+
+  _Mat inverse;
+  Mat_inv_affine_M(inverse, m);
+
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      result[i][j] = inverse[j][i];
+    }
+    result[i][3] = 0;
+    result[3][i] = 0;
+  }
+  result[3][3] = 1;
+}
+
 #endif // matrix_c_INCLUDED
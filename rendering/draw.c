@@ -3,11 +3,118 @@
 
 // Low-level 2d drawing functions
 
+#include <string.h>
+
 #include <libgfx.h>
 
 #include "../shapes/line.c"
+#include "profile.c"
+#include "heatmap.c"
+
+// == Frame == //
+
+// The renderer draws into its own buffers rather than straight to the window.
+// They persist between renders, so that parts of the scene which
+// haven't changed need not be drawn again, and frame_present copies
+// the finished frame out.
+
+typedef float Zbuf[SCREEN_WIDTH][SCREEN_HEIGHT];
+
+// Packed 0xRRGGBB color of each pixel; black is background
+typedef unsigned int Colorbuf[SCREEN_WIDTH][SCREEN_HEIGHT];
+
+// The finished frame
+Zbuf frame_zbuf;
+Colorbuf frame_color;
+
+// Every figure but the focused one, which is drawn over a copy of this
+Zbuf layer_zbuf;
+Colorbuf layer_color;
+
+// The drawing state below is per-thread, so that
+// threads can draw into buffers of their own (see render.c)
+
+// Where zbuf_draw puts colors: drawing to target_zbuf colors target_color,
+// and drawing to any other zbuf only records depth
+_Thread_local float        (*target_zbuf )[SCREEN_HEIGHT] = frame_zbuf;
+_Thread_local unsigned int (*target_color)[SCREEN_HEIGHT] = frame_color;
+
+void draw_target_set(Zbuf zbuf, Colorbuf color) {
+  target_zbuf = zbuf;
+  target_color = color;
+}
+
+// Color of drawn pixels, as last set by draw_rgb
+_Thread_local unsigned int draw_color = 0xFFFFFF;
+
+// Only pixels within this (inclusive) rectangle are drawn to the target
+typedef struct {
+  int x_lo, x_hi;
+  int y_lo, y_hi;
+} ScreenRect;
+
+int ScreenRect_is_empty(const ScreenRect rect) {
+  return rect.x_lo > rect.x_hi || rect.y_lo > rect.y_hi;
+}
+
+ScreenRect ScreenRect_union(const ScreenRect a, const ScreenRect b) {
+  /* Find the smallest rectangle containing both a and b */
+  if (ScreenRect_is_empty(a)) return b;
+  if (ScreenRect_is_empty(b)) return a;
+  return (ScreenRect) {
+    a.x_lo < b.x_lo ? a.x_lo : b.x_lo,
+    a.x_hi > b.x_hi ? a.x_hi : b.x_hi,
+    a.y_lo < b.y_lo ? a.y_lo : b.y_lo,
+    a.y_hi > b.y_hi ? a.y_hi : b.y_hi,
+  };
+}
+
+ScreenRect ScreenRect_intersect(const ScreenRect a, const ScreenRect b) {
+  /* The result is empty (see ScreenRect_is_empty) if a and b don't overlap */
+  return (ScreenRect) {
+    a.x_lo > b.x_lo ? a.x_lo : b.x_lo,
+    a.x_hi < b.x_hi ? a.x_hi : b.x_hi,
+    a.y_lo > b.y_lo ? a.y_lo : b.y_lo,
+    a.y_hi < b.y_hi ? a.y_hi : b.y_hi,
+  };
+}
+
+long ScreenRect_area(const ScreenRect rect) {
+  if (ScreenRect_is_empty(rect)) return 0;
+  return (long) (rect.x_hi - rect.x_lo + 1) * (rect.y_hi - rect.y_lo + 1);
+}
+
+ScreenRect ScreenRect_pad(const ScreenRect rect, const int padding) {
+  return (ScreenRect) {
+    rect.x_lo - padding, rect.x_hi + padding,
+    rect.y_lo - padding, rect.y_hi + padding,
+  };
+}
+
+const ScreenRect empty_rect = { 0, -1, 0, -1 };
+
+ScreenRect screen_rect() {
+  return (ScreenRect) { 0, SCREEN_WIDTH - 1, 0, SCREEN_HEIGHT - 1 };
+}
+
+_Thread_local ScreenRect draw_clip;
+
+unsigned int pack_rgb(const v3 rgb) {
+  unsigned int packed = 0;
+  for (int i = 0; i < 3; i++) {
+    const float c = rgb[i] < 0 ? 0 : rgb[i] > 1 ? 1 : rgb[i];
+    packed = (packed << 8) | (unsigned int) (c * 255 + 0.5);
+  }
+  return packed;
+}
+
+void draw_rgb(const v3 rgb) {
+  /* Set the color of pixels drawn by zbuf_draw */
+  draw_color = pack_rgb(rgb);
+}
 
 void G_rgbv(const v3 rgb) {
+  draw_rgb(rgb);
   G_rgb(rgb[0], rgb[1], rgb[2]);
 }
 
@@ -15,18 +122,103 @@ void G_pointv(const v2 point) {
   G_point(point[0], point[1]);
 }
 
+void draw_clip_reset() {
+  draw_clip = screen_rect();
+}
+
+// The calling thread's drawing state, for code which draws on behalf of another
+// thread to take on that thread's state and then put its own back
+typedef struct {
+  float        (*zbuf )[SCREEN_HEIGHT];
+  unsigned int (*color)[SCREEN_HEIGHT];
+  unsigned int rgb;
+  ScreenRect clip;
+} DrawState;
+
+DrawState draw_state_save() {
+  return (DrawState) { target_zbuf, target_color, draw_color, draw_clip };
+}
+
+void draw_state_restore(const DrawState state) {
+  target_zbuf = state.zbuf;
+  target_color = state.color;
+  draw_color = state.rgb;
+  draw_clip = state.clip;
+}
+
+void buffers_clear(Zbuf zbuf, Colorbuf color, const ScreenRect rect) {
+  /* Reset the given rectangle of a zbuf and color buffer to background */
+  PROFILE_BEGIN(stage_zbuf_init);
+  for (int x = rect.x_lo; x <= rect.x_hi; x++) {
+    for (int y = rect.y_lo; y <= rect.y_hi; y++) {
+      zbuf[x][y] = INFINITY;
+      color[x][y] = 0;
+    }
+  }
+  PROFILE_END(stage_zbuf_init);
+}
+
+void buffers_copy(Zbuf dst_zbuf, Colorbuf dst_color, const Zbuf src_zbuf, const Colorbuf src_color, const ScreenRect rect) {
+  /* Copy the given rectangle of one zbuf and color buffer to another */
+  if (ScreenRect_is_empty(rect)) return;
+  PROFILE_BEGIN(stage_compose);
+  const int height = rect.y_hi - rect.y_lo + 1;
+  for (int x = rect.x_lo; x <= rect.x_hi; x++) {
+    memcpy(&dst_zbuf [x][rect.y_lo], &src_zbuf [x][rect.y_lo], height * sizeof(float));
+    memcpy(&dst_color[x][rect.y_lo], &src_color[x][rect.y_lo], height * sizeof(unsigned int));
+  }
+  PROFILE_END(stage_compose);
+}
+
+void frame_present() {
+  /* Copy the frame to the window, skipping background */
+  PROFILE_BEGIN(stage_blit);
+
+  unsigned int current = 0;
+  for (int x = 0; x < SCREEN_WIDTH; x++) {
+    int y = 0;
+    while (y < SCREEN_HEIGHT) {
+      const unsigned int color = frame_color[x][y];
+      if (color == 0) {
+        y++;
+        continue;
+      }
+
+      // Draw runs of the same color at once; flat-shaded faces make long ones
+      const int y_start = y;
+      while (y < SCREEN_HEIGHT && frame_color[x][y] == color) y++;
+
+      if (color != current) {
+        G_rgb((color >> 16) / 255.0, ((color >> 8) & 0xFF) / 255.0, (color & 0xFF) / 255.0);
+        current = color;
+      }
+
+      if (y - y_start == 1) {
+        G_point(x, y_start);
+      } else {
+        G_fill_rectangle(x, y_start, 1, y - y_start);
+      }
+    }
+  }
+
+  PROFILE_END(stage_blit);
+}
 
-typedef float Zbuf[SCREEN_WIDTH][SCREEN_HEIGHT];
+
+// == Z-buffer == //
 
 void zbuf_init(Zbuf zbuf) {
+  PROFILE_BEGIN(stage_zbuf_init);
   for (int x = 0; x < SCREEN_WIDTH; x++) {
     for (int y = 0; y < SCREEN_HEIGHT; y++) {
       zbuf[x][y] = INFINITY;
     }
   }
+  PROFILE_END(stage_zbuf_init);
 }
 
 void zbuf_draw(Zbuf zbuf, const int x, const int y, const float z) {
+  /* Depth-test a pixel, and draw it if the zbuf is the target's */
   if (   x < 0
       || x >= SCREEN_WIDTH
       || y < 0
@@ -35,11 +227,26 @@ void zbuf_draw(Zbuf zbuf, const int x, const int y, const float z) {
     return;
   }
 
+  const int is_target = zbuf == target_zbuf;
+  if (is_target && (   x < draw_clip.x_lo
+                    || x > draw_clip.x_hi
+                    || y < draw_clip.y_lo
+                    || y > draw_clip.y_hi)
+  ) {
+    return;
+  }
+
   // Overwrite on z == zbuf[x][y] so that things
   // can be given explicit priority by being drawn later 
-  if (z <= zbuf[x][y]) {
+  const int passed = z <= zbuf[x][y];
+  if (heatmap_mode != heatmap_off && is_target) heatmap_record(x, y, passed);
+
+  if (passed) {
     zbuf[x][y] = z; 
-    G_point(x, y);
+    if (is_target) {
+      target_color[x][y] = draw_color;
+      PROFILE_COUNT(counter_pixels_written, 1);
+    }
   }
 }
 
@@ -48,6 +255,126 @@ void zbuf_drawv(Zbuf zbuf, const v2 pixel, const float z) {
 }
 
 
+// == Hierarchical z-buffer == //
+
+// A max-depth pyramid kept over the layer's zbuf (see render.c).
+// Each cell of level 0 holds the greatest z of the HIZ_TILE x HIZ_TILE
+// block of pixels it covers, and each cell of level k + 1 holds the
+// greatest z of the 2x2 cells of level k below it.
+// Anything farther than every cell it overlaps is certainly hidden.
+// Cells may be stale (too far) but never too near, so tests are conservative.
+
+#define HIZ_TILE 8
+#define HIZ_LEVELS 5
+
+#define HIZ_COLS ((SCREEN_WIDTH  + HIZ_TILE - 1) / HIZ_TILE)
+#define HIZ_ROWS ((SCREEN_HEIGHT + HIZ_TILE - 1) / HIZ_TILE)
+
+float hiz[HIZ_LEVELS][HIZ_COLS][HIZ_ROWS];
+
+int hiz_cols(const int level) {
+  return ((HIZ_COLS - 1) >> level) + 1;
+}
+
+int hiz_rows(const int level) {
+  return ((HIZ_ROWS - 1) >> level) + 1;
+}
+
+void hiz_init() {
+  PROFILE_BEGIN(stage_zbuf_init);
+  for (int level = 0; level < HIZ_LEVELS; level++) {
+    for (int i = 0; i < hiz_cols(level); i++) {
+      for (int j = 0; j < hiz_rows(level); j++) {
+        hiz[level][i][j] = INFINITY;
+      }
+    }
+  }
+  PROFILE_END(stage_zbuf_init);
+}
+
+void hiz_update(const Zbuf zbuf, int x_lo, int x_hi, int y_lo, int y_hi) {
+  /* Recalculate the pyramid over the given (inclusive) pixel rectangle */
+
+  if (x_lo < 0) x_lo = 0;
+  if (y_lo < 0) y_lo = 0;
+  if (x_hi > SCREEN_WIDTH  - 1) x_hi = SCREEN_WIDTH  - 1;
+  if (y_hi > SCREEN_HEIGHT - 1) y_hi = SCREEN_HEIGHT - 1;
+  if (x_lo > x_hi || y_lo > y_hi) return;
+
+  int i_lo = x_lo / HIZ_TILE;
+  int i_hi = x_hi / HIZ_TILE;
+  int j_lo = y_lo / HIZ_TILE;
+  int j_hi = y_hi / HIZ_TILE;
+
+  for (int i = i_lo; i <= i_hi; i++) {
+    for (int j = j_lo; j <= j_hi; j++) {
+      const int px_hi = min((i + 1) * HIZ_TILE, SCREEN_WIDTH );
+      const int py_hi = min((j + 1) * HIZ_TILE, SCREEN_HEIGHT);
+
+      float max_z = -INFINITY;
+      for (int x = i * HIZ_TILE; x < px_hi; x++) {
+        for (int y = j * HIZ_TILE; y < py_hi; y++) {
+          if (zbuf[x][y] > max_z) max_z = zbuf[x][y];
+        }
+      }
+      hiz[0][i][j] = max_z;
+    }
+  }
+
+  for (int level = 1; level < HIZ_LEVELS; level++) {
+    i_lo /= 2; i_hi /= 2;
+    j_lo /= 2; j_hi /= 2;
+
+    const int below_cols = hiz_cols(level - 1);
+    const int below_rows = hiz_rows(level - 1);
+
+    for (int i = i_lo; i <= i_hi; i++) {
+      for (int j = j_lo; j <= j_hi; j++) {
+        float max_z = -INFINITY;
+        for (int ci = 2 * i; ci <= 2 * i + 1 && ci < below_cols; ci++) {
+          for (int cj = 2 * j; cj <= 2 * j + 1 && cj < below_rows; cj++) {
+            if (hiz[level - 1][ci][cj] > max_z) max_z = hiz[level - 1][ci][cj];
+          }
+        }
+        hiz[level][i][j] = max_z;
+      }
+    }
+  }
+}
+
+int hiz_occludes(int x_lo, int x_hi, int y_lo, int y_hi, const float z) {
+  /* Would something no nearer than z inside the given pixel rectangle be entirely hidden? */
+
+  if (x_lo < 0) x_lo = 0;
+  if (y_lo < 0) y_lo = 0;
+  if (x_hi > SCREEN_WIDTH  - 1) x_hi = SCREEN_WIDTH  - 1;
+  if (y_hi > SCREEN_HEIGHT - 1) y_hi = SCREEN_HEIGHT - 1;
+  if (x_lo > x_hi || y_lo > y_hi) return 0;
+
+  int i_lo = x_lo / HIZ_TILE;
+  int i_hi = x_hi / HIZ_TILE;
+  int j_lo = y_lo / HIZ_TILE;
+  int j_hi = y_hi / HIZ_TILE;
+
+  // Climb until the rectangle covers no more than 2x2 cells
+  int level = 0;
+  while (level < HIZ_LEVELS - 1 && (i_hi - i_lo > 1 || j_hi - j_lo > 1)) {
+    level++;
+    i_lo /= 2; i_hi /= 2;
+    j_lo /= 2; j_hi /= 2;
+  }
+
+  for (int i = i_lo; i <= i_hi; i++) {
+    for (int j = j_lo; j <= j_hi; j++) {
+      // zbuf_draw draws on z <= zbuf, so only a strictly farther z is hidden
+      if (!(z > hiz[level][i][j])) return 0;
+    }
+  }
+
+  return 1;
+}
+
+
 // Scale with respect to only width OR height, because
 // scaling with respect to both will deform the object
 // by stretching it.
@@ -74,51 +401,34 @@ v3 pixel_coords_inv_z(const v2 pixel, const float z) {
 }
 
 void pixel_coords_inv_line(Line *result, const v2 pixel) {
-  const v3 p0 = pixel_coords_inv_z(pixel, 0);
-  const v3 p1 = pixel_coords_inv_z(pixel, 1);
-  Line_between(result, p0, p1);
+  /* Find the line of points which are drawn at a given pixel */
+  // This is the line from the eye through pixel_coords_inv_z(pixel, 1).
+  // It's affine in the pixel, so it's cheap enough to build on demand.
+  const v2 direction = (pixel - m) * H_over_m;
+  result->p0 = (v3) { 0, 0, 0 };
+  result->pf = (v3) { direction[0], direction[1], 1 };
 }
 
-Line *pixel_coords_inv_cache[SCREEN_WIDTH][SCREEN_HEIGHT];
 
-Line *pixel_coords_inv(const v2 pixel) {
-  const int x = pixel[0];
-  const int y = pixel[1];
-#ifdef DEBUG
-  if (x < 0 || x >= SCREEN_WIDTH || y < 0 || y >= SCREEN_HEIGHT) {
-    printf("pixel (%d, %d) is out-of-bounds\n", x, y);
-    exit(1);
-  }
-#endif
-  return pixel_coords_inv_cache[x][y];
-}
+// HALF_ANGLE that the constants were last calculated for
+float constants_half_angle = NAN;
 
+void draw_update_constants() {
+  /* Recalculate the projection constants if HALF_ANGLE has changed */
+  if (HALF_ANGLE == constants_half_angle) return;
+  constants_half_angle = HALF_ANGLE;
 
-void draw_init() {
-  // initialize constants
   H = tan(HALF_ANGLE);
   H_over_m = H / m;
   m_over_H = m / H;
   H_times_m = H * m;
-
-  // initialize inv cache
-  for (int x = 0; x < SCREEN_WIDTH; x++) {
-    for (int y = 0; y < SCREEN_HEIGHT; y++) {
-      const v2 pixel = { x, y };
-      Line *line = malloc(sizeof(Line));
-      pixel_coords_inv_line(line, pixel);
-      pixel_coords_inv_cache[x][y] = line;
-    }
-  }
 }
 
-void draw_close() {
-  for (int x = 0; x < SCREEN_WIDTH; x++) {
-    for (int y = 0; y < SCREEN_HEIGHT; y++) {
-      Line *line = pixel_coords_inv_cache[x][y];
-      free(line);
-    }
-  }
+void draw_init() {
+  draw_update_constants();
+  draw_clip_reset();
+  buffers_clear(frame_zbuf, frame_color, draw_clip);
+  buffers_clear(layer_zbuf, layer_color, draw_clip);
 }
 
 #endif // draw_c_INCLUDED
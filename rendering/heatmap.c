@@ -0,0 +1,127 @@
+#ifndef heatmap_c_INCLUDED
+#define heatmap_c_INCLUDED
+
+// Debug views which color each pixel by how much work it took
+// instead of by what's there. They're drawn over the normal image.
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <libgfx.h>
+
+#include "../shapes/v3.c"
+#include "../util/misc.c"
+
+typedef enum {
+  heatmap_off,
+  heatmap_overdraw,    // Times zbuf_draw touched the pixel
+  heatmap_depth_fail,  // Times the pixel failed the depth test
+  heatmap_cost,        // Render time of the figure the pixel shows
+  heatmap_mode_count
+} HeatmapMode;
+
+const char *heatmap_mode_names[heatmap_mode_count] = {
+  "off",
+  "overdraw",
+  "depth fails",
+  "figure cost",
+};
+
+HeatmapMode heatmap_mode = heatmap_off;
+
+// Counts at or above this are drawn in the hottest color
+const int heatmap_count_max = 8;
+
+unsigned short heatmap_touches[SCREEN_WIDTH][SCREEN_HEIGHT];
+unsigned short heatmap_depth_fails[SCREEN_WIDTH][SCREEN_HEIGHT];
+
+// Index of the figure last drawn to each pixel, or -1
+int heatmap_owner[SCREEN_WIDTH][SCREEN_HEIGHT];
+
+// The figure currently being drawn and each figure's render time
+int heatmap_figure_idx = -1;
+double *heatmap_figure_seconds = NULL;
+int heatmap_figure_count = 0;
+double heatmap_figure_start;
+// Greatest render time of any figure in the last frame
+double heatmap_max_seconds = 0;
+
+void heatmap_begin_frame(const int figure_count) {
+  memset(heatmap_touches, 0, sizeof(heatmap_touches));
+  memset(heatmap_depth_fails, 0, sizeof(heatmap_depth_fails));
+  memset(heatmap_owner, -1, sizeof(heatmap_owner));
+
+  if (figure_count != heatmap_figure_count) {
+    heatmap_figure_seconds = realloc(heatmap_figure_seconds, figure_count * sizeof(double));
+  }
+  for (int i = 0; i < figure_count; i++) heatmap_figure_seconds[i] = 0;
+  heatmap_figure_count = figure_count;
+  heatmap_figure_idx = -1;
+}
+
+void heatmap_begin_figure(const int figure_idx) {
+  heatmap_figure_idx = figure_idx;
+  heatmap_figure_start = now_seconds();
+}
+
+void heatmap_end_figure() {
+  heatmap_figure_seconds[heatmap_figure_idx] += now_seconds() - heatmap_figure_start;
+  heatmap_figure_idx = -1;
+}
+
+void heatmap_record(const int x, const int y, const int passed) {
+  /* Record a zbuf_draw call on an on-screen pixel of the draw target */
+  heatmap_touches[x][y]++;
+  if (passed) {
+    heatmap_owner[x][y] = heatmap_figure_idx;
+  } else {
+    heatmap_depth_fails[x][y]++;
+  }
+}
+
+v3 heat_color(float t) {
+  /* Color ramp from cold (t = 0, blue) to hot (t = 1, red) */
+  if (t < 0) t = 0;
+  if (t > 1) t = 1;
+  if (t < 1.0 / 3) return (v3) { 0, 3 * t, 1 - 3 * t };
+  if (t < 2.0 / 3) return (v3) { 3 * t - 1, 1, 0 };
+  return (v3) { 1, 3 - 3 * t, 0 };
+}
+
+void heatmap_render() {
+  /* Draw the current heatmap over the frame */
+
+  heatmap_max_seconds = 0;
+  for (int i = 0; i < heatmap_figure_count; i++) {
+    if (heatmap_figure_seconds[i] > heatmap_max_seconds) heatmap_max_seconds = heatmap_figure_seconds[i];
+  }
+
+  for (int x = 0; x < SCREEN_WIDTH; x++) {
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+      if (heatmap_touches[x][y] == 0) continue;
+
+      float t;
+      switch (heatmap_mode) {
+        case heatmap_overdraw:
+          t = (float) (heatmap_touches[x][y] - 1) / (heatmap_count_max - 1);
+          break;
+        case heatmap_depth_fail:
+          t = (float) heatmap_depth_fails[x][y] / heatmap_count_max;
+          break;
+        case heatmap_cost: ;
+          const int owner = heatmap_owner[x][y];
+          if (owner < 0 || heatmap_max_seconds == 0) continue;
+          t = heatmap_figure_seconds[owner] / heatmap_max_seconds;
+          break;
+        default:
+          return;
+      }
+
+      const v3 color = heat_color(t);
+      G_rgb(color[0], color[1], color[2]);
+      G_point(x, y);
+    }
+  }
+}
+
+#endif // heatmap_c_INCLUDED
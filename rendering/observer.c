@@ -7,45 +7,45 @@
 #include "../shapes/observer_figure.c"
 #include "../matrix.c"
 
-void calc_eyespace_matrix_M(_Mat result, const Observer *ob) {
-  /* Calculate the matrix that takes shapes from world space to eye space */
-
-  // Local copy of observer
-  Observer clone;
-  memcpy(&clone, ob, sizeof(Observer));
-
-  // Move the observer to the origin
-  _Mat observer_to_origin = Mat_translate_v(-ob->position);
-
-  // Emulate doing this to the existing stuff
-  Observer_transform(&clone, observer_to_origin);
-
-  // Rotate observer so that the interest is on the y-z plane
-  const float theta1 = -atan2(clone.interest[0], clone.interest[2]);
-  const _Mat align_interest_1 = Mat_y_rot(theta1);
-
-  // Emulate doing this to the existing stuff
-  Observer_transform(&clone, align_interest_1);
-
-  // Rotate observer so that the interest is on the z-axis
-  const float theta2 = +atan2(clone.interest[1], clone.interest[2]);
-  const _Mat align_interest_2 = Mat_x_rot(theta2);
-
-  // Emulate doing this to the existing stuff
-  Observer_transform(&clone, align_interest_2);
-
-  // Rotate observer so that the up point is on the y-z plane
-  const float theta3 = +atan2(clone.up_point[0], clone.up_point[1]);
-  const _Mat align_up_point = Mat_z_rot(theta3);
+static void Observer_update_eyespace(Observer *ob) {
+  /* Find the matrix that takes shapes from world space to eye space,
+     in which the observer is at the origin looking down +z with the
+     up point above it (+y) */
+
+  // The eye-space axes, in world space
+  const v3 z_axis = v3_normalize(ob->interest - ob->position);
+
+  // The part of the up direction perpendicular to the line of sight
+  const v3 up = ob->up_point - ob->position;
+  v3 y_axis = up - v3_dot(up, z_axis) * z_axis;
+
+  if (v3_mag(y_axis) <= 1e-6 * v3_mag(up)) {
+    // The up point is in line with the interest, or at the observer, so any
+    // perpendicular will do; take the one nearest to world y
+    const v3 world_y = fabs(z_axis[1]) < 0.9 ? (v3) { 0, 1, 0 } : (v3) { 1, 0, 0 };
+    y_axis = world_y - v3_dot(world_y, z_axis) * z_axis;
+  }
+  y_axis = v3_normalize(y_axis);
+
+  const v3 x_axis = v3_cross(y_axis, z_axis);
+
+  // Move the observer to the origin, then rotate the axes onto x, y, z
+  const v3 p = ob->position;
+  _Mat to_eyespace = {
+    { x_axis[0], x_axis[1], x_axis[2], -v3_dot(x_axis, p) },
+    { y_axis[0], y_axis[1], y_axis[2], -v3_dot(y_axis, p) },
+    { z_axis[0], z_axis[1], z_axis[2], -v3_dot(z_axis, p) },
+    { 0        , 0        , 0        , 1                  },
+  };
+
+  Mat_clone_M(ob->to_eyespace, to_eyespace);
+  ob->eyespace_stale = 0;
+}
 
-  // Compose all the matrices
-  Mat_chain_M(
-    result, 4,
-    observer_to_origin,
-    align_interest_1,
-    align_interest_2,
-    align_up_point
-  );
+void calc_eyespace_matrix_M(_Mat result, Observer *ob) {
+  /* Calculate the matrix that takes shapes from world space to eye space */
+  if (ob->eyespace_stale) Observer_update_eyespace(ob);
+  Mat_clone_M(result, ob->to_eyespace);
 }
 
 #endif // observer_c_INCLUDED
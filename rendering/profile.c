@@ -0,0 +1,150 @@
+#ifndef profile_c_INCLUDED
+#define profile_c_INCLUDED
+
+// Per-stage frame profiler
+//
+// Build with -DPROFILE (e.g. `./build.sh -DPROFILE`) to enable it.
+// Without PROFILE, every macro below expands to nothing, so the
+// instrumented code is exactly as it would be without it.
+//
+// When enabled, the previous frame's stage timings and counters are shown
+// in the overlay, and if the environment variable PROFILE_CSV names a file,
+// one row per frame is appended to it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../util/misc.c"
+
+typedef enum {
+  stage_eyespace,   // Transforming figures into eye space
+  stage_zbuf_init,  // Clearing zbufs, zrecords, and the frame
+  stage_clip,       // Polygon_clip
+  stage_light,      // Polygon lighting
+  stage_raster,     // Filling polygons
+  stage_halo,       // display_halo
+  stage_compose,    // Copying the cached layer into the frame
+  stage_blit,       // frame_present
+  stage_present,    // Showing the frame
+  stage_count
+} ProfileStage;
+
+const char *profile_stage_names[stage_count] = {
+  "eyespace",
+  "zbuf_init",
+  "clip",
+  "light",
+  "raster",
+  "halo",
+  "compose",
+  "blit",
+  "present",
+};
+
+typedef enum {
+  counter_polygons_clipped,  // Polygons entirely removed by clipping
+  counter_polygons_culled,   // Polygons removed by backface elimination
+  counter_pixels_written,    // Pixels which passed the depth test
+  counter_count
+} ProfileCounter;
+
+const char *profile_counter_names[counter_count] = {
+  "polygons_clipped",
+  "polygons_culled",
+  "pixels_written",
+};
+
+typedef struct {
+  double stage_seconds[stage_count];
+  long counters[counter_count];
+  double total_seconds;
+} FrameProfile;
+
+#ifdef PROFILE
+
+// The frame being measured and the last complete one
+FrameProfile profile_current;
+FrameProfile profile_last;
+
+double profile_frame_start;
+long profile_frame_number = 0;
+
+FILE *profile_csv = NULL;
+
+void profile_frame_begin_() {
+  memset(&profile_current, 0, sizeof(FrameProfile));
+  profile_frame_start = now_seconds();
+}
+
+void profile_frame_end_() {
+  profile_current.total_seconds = now_seconds() - profile_frame_start;
+  memcpy(&profile_last, &profile_current, sizeof(FrameProfile));
+
+  if (profile_frame_number == 0) {
+    const char *path = getenv("PROFILE_CSV");
+    if (path != NULL) {
+      profile_csv = fopen(path, "a");
+      if (profile_csv == NULL) {
+        printf("Cannot open profile file %s\n", path);
+        exit(1);
+      }
+
+      fprintf(profile_csv, "frame,total_ms");
+      for (int i = 0; i < stage_count; i++) fprintf(profile_csv, ",%s_ms", profile_stage_names[i]);
+      for (int i = 0; i < counter_count; i++) fprintf(profile_csv, ",%s", profile_counter_names[i]);
+      fprintf(profile_csv, "\n");
+    }
+  }
+
+  if (profile_csv != NULL) {
+    fprintf(profile_csv, "%ld,%f", profile_frame_number, profile_last.total_seconds * 1000);
+    for (int i = 0; i < stage_count; i++) fprintf(profile_csv, ",%f", profile_last.stage_seconds[i] * 1000);
+    for (int i = 0; i < counter_count; i++) fprintf(profile_csv, ",%ld", profile_last.counters[i]);
+    fprintf(profile_csv, "\n");
+    fflush(profile_csv);
+  }
+
+  profile_frame_number++;
+}
+
+// Where the calling thread's timings and counts go. Other threads than
+// the main one collect theirs separately (set with PROFILE_SINK), to be
+// added to the frame's with PROFILE_MERGE, so with several threads the
+// stages may add up to more than the frame took.
+_Thread_local FrameProfile *profile_sink = &profile_current;
+
+void profile_merge_(FrameProfile *profile) {
+  /* Add a thread's measurements to the frame's, and zero them for next time */
+  for (int i = 0; i < stage_count; i++) profile_current.stage_seconds[i] += profile->stage_seconds[i];
+  for (int i = 0; i < counter_count; i++) profile_current.counters[i] += profile->counters[i];
+  memset(profile, 0, sizeof(FrameProfile));
+}
+
+#define PROFILE_FRAME_BEGIN() profile_frame_begin_();
+#define PROFILE_FRAME_END() profile_frame_end_();
+
+#define PROFILE_SINK(profile) profile_sink = (profile);
+#define PROFILE_MERGE(profile) profile_merge_(profile);
+
+#define PROFILE_BEGIN(stage) \
+  const double profile_start_ ## stage = now_seconds();
+#define PROFILE_END(stage) \
+  profile_sink->stage_seconds[stage] += now_seconds() - profile_start_ ## stage;
+
+#define PROFILE_COUNT(counter, n) \
+  profile_sink->counters[counter] += (n);
+
+#else
+
+#define PROFILE_FRAME_BEGIN()
+#define PROFILE_FRAME_END()
+#define PROFILE_SINK(profile)
+#define PROFILE_MERGE(profile)
+#define PROFILE_BEGIN(stage)
+#define PROFILE_END(stage)
+#define PROFILE_COUNT(counter, n)
+
+#endif // PROFILE
+
+#endif // profile_c_INCLUDED
@@ -0,0 +1,242 @@
+#ifndef raster_c_INCLUDED
+#define raster_c_INCLUDED
+
+// Polygon filling by edge functions
+//
+// Each edge of a convex polygon splits the screen in two, and a pixel is
+// covered by the polygon when it's on the inner side of every edge. Which
+// side it's on is the sign of the edge's function E(x, y) = A x + B y + C,
+// which is positive inside.
+//
+// Vertices are snapped to fixed point, RASTER_SUBPIXEL_BITS bits below the
+// pixel, so that edge functions are exact integers. Polygons sharing an edge
+// then agree exactly about which side of it every pixel is on, and a pixel
+// exactly on the edge (E = 0) goes to only one of them by the top-left rule:
+// it belongs to the polygon whose inside is to its right (+x) or, for an edge
+// along x, below it (+y). So every pixel of a mesh is filled once, not twice.
+//
+// Pixels are visited in RASTER_BLOCK-square blocks. A block wholly outside
+// some edge is skipped, and a block inside every edge is filled without
+// testing its pixels. Only blocks on the boundary test each pixel,
+// RASTER_LANES of a column at a time as the lanes of a vector.
+
+#include <math.h>
+#include <limits.h>
+
+#include "draw.c"
+#include "../shapes/polygon.c"
+#include "../shapes/plane.c"
+#include "../shapes/v2.c"
+
+#define RASTER_SUBPIXEL_BITS 4
+#define RASTER_ONE (1 << RASTER_SUBPIXEL_BITS)
+
+#define RASTER_BLOCK 8
+
+// Pixels of a column tested at once. Four ints or floats fill the
+// narrowest vector registers, which every target has.
+#define RASTER_LANES 4
+
+// Snapped vertices must lie within this many pixels of the origin for edge
+// functions to fit in an int. Polygons which reach further, which only
+// happens with clipping off, are left to Polygon_render_as_is.
+#define RASTER_GUARD_BAND 1024
+
+// Added to fixed-point coordinates to make them positive, so that
+// rounding and dividing by truncation goes the same way for all of them
+#define RASTER_OFFSET (RASTER_GUARD_BAND * RASTER_ONE)
+
+// A value for each of RASTER_LANES consecutive pixels of a column
+typedef int   RasterLanes  __attribute__ (( vector_size(RASTER_LANES * sizeof(int  )) ));
+typedef float RasterLanesf __attribute__ (( vector_size(RASTER_LANES * sizeof(float)) ));
+
+const RasterLanes  raster_lane_offsets  = { 0, 1, 2, 3 };
+const RasterLanesf raster_lane_offsetsf = { 0, 1, 2, 3 };
+
+// The function of an edge, in steps of whole pixels:
+// E(x, y) = a x + b y + c at pixel (x, y). The top-left rule is folded
+// into c, so that a pixel is on the inner side of the edge iff E >= 0.
+typedef struct {
+  int a;
+  int b;
+  int c;
+} RasterEdge;
+
+int RasterEdge_at(const RasterEdge *edge, const int x, const int y) {
+  return edge->a * x + edge->b * y + edge->c;
+}
+
+int Polygon_snap_M(int *xs, int *ys, const Polygon *polygon) {
+  /* Find the fixed-point pixel coordinates of the polygon's points.
+     Returns 0 if any is behind the eye or outside the guard band */
+  for (int i = 0; i < polygon->length; i++) {
+    const v3 point = Polygon_get(polygon, i);
+    if (point[2] <= 0) return 0;
+
+    const v2 pixel = pixel_coords(point);
+    // Written so as to be false for NaN too
+    if (!(fabs(pixel[0]) < RASTER_GUARD_BAND && fabs(pixel[1]) < RASTER_GUARD_BAND)) return 0;
+
+    xs[i] = (int) (pixel[0] * RASTER_ONE + (RASTER_OFFSET + .5f)) - RASTER_OFFSET;
+    ys[i] = (int) (pixel[1] * RASTER_ONE + (RASTER_OFFSET + .5f)) - RASTER_OFFSET;
+  }
+  return 1;
+}
+
+int snapped_is_convex(const int *xs, const int *ys, const int n) {
+  /* Does the snapped polygon turn only one way, and go around only once? */
+  int left_turns = 0;
+  int right_turns = 0;
+  int x_reversals = 0;
+  int last_dx_sign = 0;
+
+  for (int i = 0; i < n; i++) {
+    const int j = i + 1 < n ? i + 1 : i + 1 - n;
+    const int k = i + 2 < n ? i + 2 : i + 2 - n;
+    const long long turn =
+        (long long) (xs[j] - xs[i]) * (ys[k] - ys[j])
+      - (long long) (ys[j] - ys[i]) * (xs[k] - xs[j]);
+    if (turn > 0) left_turns++;
+    if (turn < 0) right_turns++;
+
+    // A star turns one way too, but doubles back along x more than twice
+    const int dx_sign = sgn(xs[j] - xs[i]);
+    if (dx_sign != 0) {
+      if (last_dx_sign != 0 && dx_sign != last_dx_sign) x_reversals++;
+      last_dx_sign = dx_sign;
+    }
+  }
+
+  // Not counting from the last edge round to the first, a convex polygon
+  // reverses at most twice, and a star at least three times
+  return (left_turns == 0 || right_turns == 0) && x_reversals <= 2;
+}
+
+int Polygon_rasterize(const Polygon *polygon, Zbuf zbuf, Zbuf zrecord) {
+  /* Fill a convex polygon, depth-testing into zbuf and recording depths in zrecord
+     unless it's NULL. Returns 0, having drawn nothing, if it can't: if the
+     polygon isn't convex, or reaches beyond the guard band */
+
+  const int n = polygon->length;
+  if (n < 3) return 0;
+
+  int xs[n];
+  int ys[n];
+  if (!Polygon_snap_M(xs, ys, polygon)) return 0;
+  if (n > 3 && !snapped_is_convex(xs, ys, n)) return 0;
+
+  // Each edge's function is the cross product of the edge with P less its start,
+  // and C summed over the edges is twice the polygon's signed area
+  RasterEdge edges[n];
+  int edge_count = 0;
+  long long area = 0;
+  int min_x = INT_MAX, max_x = INT_MIN;
+  int min_y = INT_MAX, max_y = INT_MIN;
+
+  for (int i = 0; i < n; i++) {
+    const int j = i + 1 < n ? i + 1 : 0;
+
+    if (xs[i] < min_x) min_x = xs[i];
+    if (xs[i] > max_x) max_x = xs[i];
+    if (ys[i] < min_y) min_y = ys[i];
+    if (ys[i] > max_y) max_y = ys[i];
+
+    const int A = ys[i] - ys[j];
+    const int B = xs[j] - xs[i];
+    const long long C = (long long) xs[i] * ys[j] - (long long) xs[j] * ys[i];
+    area += C;
+    if (A == 0 && B == 0) continue;
+    edges[edge_count++] = (RasterEdge) { A, B, (int) C };
+  }
+
+  // Covers no pixel centers, and has no plane to take depths from
+  if (area == 0) return 1;
+
+  for (int i = 0; i < edge_count; i++) {
+    RasterEdge *edge = &edges[i];
+
+    // Make the inside positive
+    if (area < 0) *edge = (RasterEdge) { -edge->a, -edge->b, -edge->c };
+
+    // Top-left rule: pixels on the edge are only kept by a polygon to its right or below it
+    const int owns_edge = edge->a > 0 || (edge->a == 0 && edge->b > 0);
+    if (!owns_edge) edge->c -= 1;
+
+    edge->a *= RASTER_ONE;
+    edge->b *= RASTER_ONE;
+  }
+
+  // Pixels whose centers lie within the snapped bounding box, and within the clip rectangle
+  const ScreenRect bounds = ScreenRect_intersect(draw_clip, (ScreenRect) {
+    (min_x + RASTER_OFFSET + RASTER_ONE - 1) / RASTER_ONE - RASTER_GUARD_BAND,
+    (max_x + RASTER_OFFSET                 ) / RASTER_ONE - RASTER_GUARD_BAND,
+    (min_y + RASTER_OFFSET + RASTER_ONE - 1) / RASTER_ONE - RASTER_GUARD_BAND,
+    (max_y + RASTER_OFFSET                 ) / RASTER_ONE - RASTER_GUARD_BAND,
+  });
+  if (ScreenRect_is_empty(bounds)) return 1;
+
+  // 1 / z is affine in pixel coordinates over the polygon's plane, as found by
+  // intersecting the plane with the line of each pixel (see pixel_coords_inv_line)
+  Plane plane;
+  Plane_from_polygon(&plane, polygon);
+  const float d = v3_dot(plane.normal, plane.p0);
+  if (d == 0) return 1;
+  const float w_a = plane.normal[0] * H_over_m / d;
+  const float w_b = plane.normal[1] * H_over_m / d;
+  const float w_c = (plane.normal[2] - (plane.normal[0] + plane.normal[1]) * m * H_over_m) / d;
+
+  const int span = RASTER_BLOCK - 1;
+
+  for (int bx = bounds.x_lo; bx <= bounds.x_hi; bx += RASTER_BLOCK) {
+    for (int by = bounds.y_lo; by <= bounds.y_hi; by += RASTER_BLOCK) {
+
+      // Compare the block's corners to each edge
+      int is_outside = 0;
+      int is_inside = 1;
+      for (int i = 0; i < edge_count && !is_outside; i++) {
+        const RasterEdge *edge = &edges[i];
+        const int e = RasterEdge_at(edge, bx, by);
+        const int e_max = e + (edge->a > 0 ? edge->a * span : 0) + (edge->b > 0 ? edge->b * span : 0);
+        const int e_min = e + (edge->a < 0 ? edge->a * span : 0) + (edge->b < 0 ? edge->b * span : 0);
+        if (e_max < 0) is_outside = 1;
+        if (e_min < 0) is_inside = 0;
+      }
+      if (is_outside) continue;
+
+      // The last block of a row or column may reach past the bounds
+      const int x_end = bx + span < bounds.x_hi ? bx + span : bounds.x_hi;
+      const int y_end = by + span < bounds.y_hi ? by + span : bounds.y_hi;
+
+      for (int x = bx; x <= x_end; x++) {
+        for (int y0 = by; y0 <= y_end; y0 += RASTER_LANES) {
+          const int lane_count = y_end - y0 < RASTER_LANES ? y_end - y0 + 1 : RASTER_LANES;
+
+          RasterLanes covered = raster_lane_offsets < lane_count;
+          if (!is_inside) {
+            for (int i = 0; i < edge_count; i++) {
+              const RasterEdge *edge = &edges[i];
+              const RasterLanes e = RasterEdge_at(edge, x, y0) + edge->b * raster_lane_offsets;
+              covered &= e >= 0;
+            }
+          }
+
+          const RasterLanesf w = (w_a * x + w_b * y0 + w_c) + w_b * raster_lane_offsetsf;
+          const RasterLanesf z = 1 / w;
+
+          for (int lane = 0; lane < lane_count; lane++) {
+            if (!covered[lane]) continue;
+            const int y = y0 + lane;
+            zbuf_draw(zbuf, x, y, z[lane]);
+            if (zrecord != NULL) zrecord[x][y] = z[lane];
+          }
+        }
+      }
+
+    }
+  }
+
+  return 1;
+}
+
+
+#endif // raster_c_INCLUDED
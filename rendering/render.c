@@ -5,10 +5,16 @@
 
 #include <math.h>
 #include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
 
 #include "observer.c"
 #include "draw.c"
+#include "raster.c"
 #include "../util/misc.c"
+#include "../util/arena.c"
+#include "../util/pool.c"
 #include "../shapes/polygon.c"
 #include "../shapes/polyhedron.c"
 #include "../shapes/figure.c"
@@ -17,39 +23,167 @@
 
 
 
-float clamp(float x, float lo, float hi);
+// Per-frame counts of geometry skipped by occlusion culling
+atomic_int occluded_figure_count  = 0;
+atomic_int occluded_polygon_count = 0;
+
+// How far the focused figure's halo reaches beyond its silhouette
+const int halo_width = 5;
+
+// == Visibility ids == //
+
+// With DO_DEFERRED_SHADING, figures drawn into the layer aren't shaded as
+// they're drawn. Instead of a color, each pixel is given a visibility id
+// naming the figure and the primitive (polygon, or lattice point) drawn
+// there, which is depth-tested and merged just as a color is. Once the
+// layer is drawn, shade_deferred replaces every id left with a color, so
+// each visible pixel is shaded once, and hidden surfaces not at all. What
+// it shades from (a clipped polygon's center and normal, or the point where
+// an intersector was hit) is recorded as the id is drawn, in shade_records.
+//
+// An id has VISIBILITY_FLAG set, which a packed color never does. Below it,
+// the figure's index takes as many bits as the figure count needs and the
+// primitive's index takes the rest. If some figure has too many primitives
+// for that, the layer is shaded as it's drawn instead.
+
+#define VISIBILITY_FLAG (1u << 31)
+
+// Bits of an id holding the primitive's index, for the frame being rendered
+int visibility_primitive_bits = 0;
+
+// Index of the figure being drawn, if it's to be given visibility ids, or else -1
+_Thread_local int drawing_figure_index = -1;
+
+unsigned int visibility_id(const int figure_index, const int primitive_index) {
+  return VISIBILITY_FLAG | (unsigned int) figure_index << visibility_primitive_bits | (unsigned int) primitive_index;
+}
+
+int visibility_figure_index(const unsigned int id) {
+  return (id & ~VISIBILITY_FLAG) >> visibility_primitive_bits;
+}
+
+int visibility_primitive_index(const unsigned int id) {
+  return id & ((1u << visibility_primitive_bits) - 1);
+}
+
+// What a polygon drawn with a visibility id is shaded from
+typedef struct {
+  v3 center;
+  v3 normal;
+} PolygonShade;
+
+// What a figure drawn with visibility ids is shaded from: for polyhedra and
+// mesh instances, each clipped polygon, and for intersectors and SDFs, the
+// point hit at each pixel of rect, column by column. Intersector normals
+// take several more rays, so are only found for the points left visible.
+// Lattices are shaded from the lattice itself.
+typedef struct {
+  PolygonShade *polygons;
+  v3 *points;
+  ScreenRect rect;
+} ShadeRecord;
+
+// By figure index, for the frame being rendered
+ShadeRecord *shade_records = NULL;
+
+v3 *ShadeRecord_point(const ShadeRecord *record, const int x, const int y) {
+  const int height = record->rect.y_hi - record->rect.y_lo + 1;
+  return &record->points[(x - record->rect.x_lo) * height + (y - record->rect.y_lo)];
+}
 
 void v3_render(const v3 v, Zbuf zbuf) {
   const v2 px = pixel_coords(v);
   zbuf_drawv(zbuf, px, v[2]);
 }
 
-void Line_render(const Line *line, Zbuf zbuf) {
-  const v2 px0 = pixel_coords(line->p0);
-  const v2 pxf = pixel_coords(line->pf);
+// Cohen-Sutherland outcodes, relative to the screen
+#define OUT_LEFT  1
+#define OUT_RIGHT 2
+#define OUT_BELOW 4
+#define OUT_ABOVE 8
 
-  const int x_lo = (int) floor(px0[0]);
-  const int x_hi = (int) ceil(pxf[0]);
-  for (int x = x_lo; x <= x_hi; x++) {
-    const float t = (x - px0[0]) / (pxf[0] - px0[0]);
-    if (0 <= t && t <= 1) {
-      const v3 point = line->p0 + t * (line->pf - line->p0);
-      const v2 pixel = pixel_coords(point);
-      zbuf_drawv(zbuf, pixel, point[2]);
+int screen_outcode(const float x, const float y) {
+  int code = 0;
+  if (x < 0) code |= OUT_LEFT;
+  else if (x > SCREEN_WIDTH - 1) code |= OUT_RIGHT;
+
+  if (y < 0) code |= OUT_BELOW;
+  else if (y > SCREEN_HEIGHT - 1) code |= OUT_ABOVE;
+  return code;
+}
+
+int clip_to_screen(v3 *a, v3 *b) {
+  /* Clip the screen-space segment between a and b to the screen.
+   * Points are (pixel x, pixel y, 1/z); 1/z is linear in screen space
+   * so it's interpolated along with the pixel coordinates.
+   * Returns 0 if nothing of the segment is on screen */
+
+  int code_a = screen_outcode((*a)[0], (*a)[1]);
+  int code_b = screen_outcode((*b)[0], (*b)[1]);
+
+  while (code_a | code_b) {
+    if (code_a & code_b) return 0;
+
+    const int code = code_a ? code_a : code_b;
+    const v3 d = *b - *a;
+
+    v3 point;
+    if (code & OUT_LEFT) {
+      point = *a + d * ((0 - (*a)[0]) / d[0]);
+      point[0] = 0;
+    } else if (code & OUT_RIGHT) {
+      point = *a + d * ((SCREEN_WIDTH - 1 - (*a)[0]) / d[0]);
+      point[0] = SCREEN_WIDTH - 1;
+    } else if (code & OUT_BELOW) {
+      point = *a + d * ((0 - (*a)[1]) / d[1]);
+      point[1] = 0;
+    } else {
+      point = *a + d * ((SCREEN_HEIGHT - 1 - (*a)[1]) / d[1]);
+      point[1] = SCREEN_HEIGHT - 1;
     }
-  }
 
-  const int y_lo = (int) floor(px0[1]);
-  const int y_hi = (int) ceil(pxf[1]);
-  for (int y = y_lo; y <= y_hi; y++) {
-    const float t = (y - px0[1]) / (pxf[1] - px0[1]);
-    if (0 <= t && t <= 1) {
-      const v3 point = line->p0 + t * (line->pf - line->p0);
-      const v2 pixel = pixel_coords(point);
-      zbuf_drawv(zbuf, pixel, point[2]);
+    if (code == code_a) {
+      *a = point;
+      code_a = screen_outcode(point[0], point[1]);
+    } else {
+      *b = point;
+      code_b = screen_outcode(point[0], point[1]);
     }
   }
 
+  return 1;
+}
+
+// Lines are cut off just in front of the eye, since
+// points at or behind it have no pixel coordinates
+const float line_near_z = 1e-3;
+
+void Line_render(const Line *line, Zbuf zbuf) {
+  v3 p0 = line->p0;
+  v3 pf = line->pf;
+
+  if (p0[2] < line_near_z && pf[2] < line_near_z) return;
+  if (p0[2] < line_near_z) p0 = p0 + (pf - p0) * ((line_near_z - p0[2]) / (pf[2] - p0[2]));
+  if (pf[2] < line_near_z) pf = pf + (p0 - pf) * ((line_near_z - pf[2]) / (p0[2] - pf[2]));
+
+  const v2 px0 = pixel_coords(p0);
+  const v2 pxf = pixel_coords(pf);
+  v3 a = { px0[0], px0[1], 1 / p0[2] };
+  v3 b = { pxf[0], pxf[1], 1 / pf[2] };
+
+  if (!clip_to_screen(&a, &b)) return;
+
+  // DDA: one step per pixel along the major axis,
+  // with 1/z stepped alongside
+  const v3 d = b - a;
+  const int steps = (int) ceil(fmax(fabs(d[0]), fabs(d[1])));
+  const v3 step = steps == 0 ? v3_zero : d / (float) steps;
+
+  v3 point = a;
+  for (int i = 0; i <= steps; i++) {
+    zbuf_draw(zbuf, (int) (point[0] + 0.5), (int) (point[1] + 0.5), 1 / point[2]);
+    point += step;
+  }
 }
 
 int shouldnt_render(const Polygon *polygon) {
@@ -146,11 +280,11 @@ void Polygon_render_as_is(const Polygon *polygon, Zbuf zbuf, Zbuf zrecord) {
     if (y > max_py) max_py = y;
   }
 
-  // Range of iteration
-  const int x_lo = (int) clamp(floor(min_px), 0, SCREEN_WIDTH  - 1);
-  const int x_hi = (int) clamp( ceil(max_px), 0, SCREEN_WIDTH  - 1);
-  const int y_lo = (int) clamp(floor(min_py), 0, SCREEN_HEIGHT - 1);
-  const int y_hi = (int) clamp( ceil(max_py), 0, SCREEN_HEIGHT - 1);
+  // Range of iteration; nothing outside the clip rectangle would be drawn
+  const int x_lo = (int) clamp(floor(min_px), draw_clip.x_lo, draw_clip.x_hi);
+  const int x_hi = (int) clamp( ceil(max_px), draw_clip.x_lo, draw_clip.x_hi);
+  const int y_lo = (int) clamp(floor(min_py), draw_clip.y_lo, draw_clip.y_hi);
+  const int y_hi = (int) clamp( ceil(max_py), draw_clip.y_lo, draw_clip.y_hi);
 
   // Find the plane of the polygon
   Plane polygon_plane;
@@ -197,12 +331,13 @@ void Polygon_render_as_is(const Polygon *polygon, Zbuf zbuf, Zbuf zrecord) {
 
       // There is an infinite line of values with
       // the desired pixel coordinates.
-      Line *line = pixel_coords_inv(px);
+      Line line;
+      pixel_coords_inv_line(&line, px);
 
       // Now find the point on it that intersects with the polygon
       v3 intersection;
       const int found_intersection =
-        Plane_intersect_line_M(&intersection, &polygon_plane, line);
+        Plane_intersect_line_M(&intersection, &polygon_plane, &line);
 
 #ifdef DEBUG
       if (!found_intersection) {
@@ -213,28 +348,52 @@ void Polygon_render_as_is(const Polygon *polygon, Zbuf zbuf, Zbuf zrecord) {
 
       const float z = intersection[2];
       zbuf_draw(zbuf, x, y, z);
-      zrecord[x][y] = z;
+      if (zrecord != NULL) zrecord[x][y] = z;
 
     }
   }
 
 }
 
+// Memory for the frame being rendered, i.e. the eye-space
+// copies of the figures. Reset at the start of every frame.
+Arena *frame_arena = NULL;
+
+// Each thread's memory for the polygons made by clipping,
+// which only last while one polygon is rendered
+_Thread_local Arena *scratch_arena = NULL;
+
+// What each worker of the thread pool but the first (which
+// is this thread) measured while rendering the frame
+FrameProfile render_profiles[POOL_MAX_WORKERS];
+
+void render_profile_worker() {
+  /* Have the calling worker's measurements go to its own profile */
+  const int worker_i = pool_worker_index();
+  if (worker_i > 0) PROFILE_SINK(&render_profiles[worker_i]);
+}
+
+void render_profile_merge() {
+  /* Add the workers' measurements to the frame's. Only once no tasks are running */
+  for (int worker_i = 1; worker_i < POOL_MAX_WORKERS; worker_i++) PROFILE_MERGE(&render_profiles[worker_i]);
+}
+
 void Polygon_clip_with_plane(Polygon *polygon, const Plane *plane) {
   // Clip a polygongon with a plane
   // The portion of the shape on the on the same side as the point
   //   (0, 0, (YON + HITHER)/2) will be kept
   //   (given that YON > HITHER)
-  // Frees removed points
+  // The clipped points are put in scratch_arena
 
   // If HITHER >= YON, then all polyhedra are entirely clipped
   if (HITHER >= YON) {
-    Polygon_clear(polygon);
+    // polygon may be a shallow copy, so its items must be left alone
+    polygon->length = 0;
     return;
   }
 
   Polygon result_polygon;
-  Polygon_init(&result_polygon, polygon->length + 1);
+  Polygon_init_in(&result_polygon, polygon->length + 1, scratch_arena);
   // We can gain at most one point from clipping, so polygon->length+1 is an upper bound
 
   // Create a point that's definitely inside the clipping region
@@ -326,42 +485,127 @@ void Polygon_clip(Polygon *polygon) {
   Polygon_clip_with_plane(polygon, &yon_plane);
 }
 
+int Polygon_screen_rect_M(ScreenRect *rect, float *min_z, const Polygon *polygon) {
+  /* Find the pixel rectangle covered by the polygon, and its nearest z-value.
+   * Returns 0 if the polygon reaches to or behind the eye */
+
+  float min_px = +INFINITY;
+  float max_px = -INFINITY;
+  float min_py = +INFINITY;
+  float max_py = -INFINITY;
+  *min_z = +INFINITY;
+
+  for (int i = 0; i < polygon->length; i++) {
+    const v3 point = Polygon_get(polygon, i);
+
+    // Projection is meaningless for points at or behind the eye
+    if (point[2] <= 0) return 0;
+
+    const v2 pixel = pixel_coords(point);
+    if (point[2] < *min_z) *min_z = point[2];
+    if (pixel[0] < min_px) min_px = pixel[0];
+    if (pixel[0] > max_px) max_px = pixel[0];
+    if (pixel[1] < min_py) min_py = pixel[1];
+    if (pixel[1] > max_py) max_py = pixel[1];
+  }
+
+  rect->x_lo = (int) clamp(floor(min_px), -1, SCREEN_WIDTH );
+  rect->x_hi = (int) clamp( ceil(max_px), -1, SCREEN_WIDTH );
+  rect->y_lo = (int) clamp(floor(min_py), -1, SCREEN_HEIGHT);
+  rect->y_hi = (int) clamp( ceil(max_py), -1, SCREEN_HEIGHT);
+  return 1;
+}
+
+int Polygon_occluded(const Polygon *polygon) {
+  /* Is the polygon certainly hidden behind what's already been drawn? */
+  ScreenRect rect;
+  float min_z;
+  if (!Polygon_screen_rect_M(&rect, &min_z, polygon)) return 0;
+  return hiz_occludes(rect.x_lo, rect.x_hi, rect.y_lo, rect.y_hi, min_z);
+}
+
+int Polygon_outside_clip(const Polygon *polygon) {
+  /* Does the polygon certainly lie outside of draw_clip? */
+  ScreenRect rect;
+  float min_z;
+  if (!Polygon_screen_rect_M(&rect, &min_z, polygon)) return 0;
+  return ScreenRect_is_empty(ScreenRect_intersect(rect, draw_clip));
+}
+
 void Polygon_render(
   const Polygon *polygon,
   const int is_focused,
   const v3 light_source_loc,
+  const v3 inherent_rgb,
+  const unsigned int visibility,
   Zbuf zbuf,
   Zbuf zrecord
 ) {
-  // record all z-values on zrecord, whether or not they get drawn
+  // record all z-values on zrecord, whether or not they get drawn,
+  // unless it's NULL
+
+  // visibility: the polygon's visibility id, or 0 to shade it now
 
   // focused: is the polygongon part of the focused polyhedron? (NOT part of the halo)
 
+  // When redrawing only part of the frame, most polygons can be skipped
+  // before the comparatively costly clipping
+  if (Polygon_outside_clip(polygon)) return;
+
+  if (scratch_arena == NULL) scratch_arena = Arena_new(1 << 16);
+  Arena_reset(scratch_arena);
+
   Polygon clipped;
   memcpy(&clipped, polygon, sizeof(Polygon));
 
   if (DO_CLIPPING) {
+    PROFILE_BEGIN(stage_clip);
     Polygon_clip(&clipped);
+    PROFILE_END(stage_clip);
   }
 
   // Only render if there are points
   // (Some render subroutines require a minimum point count)
-  if (clipped.length == 0) return;
+  if (clipped.length == 0) {
+    PROFILE_COUNT(counter_polygons_clipped, 1);
+    return;
+  }
 
-  v3 color = { .8, .5, .8 };
-  if (DO_LIGHT_MODEL) {
-    color = Polygon_calc_color(&clipped, light_source_loc, color);
+  // The focused polygons are always drawn, since the halo
+  // is built from every pixel they cover
+  if (DO_OCCLUSION_CULLING && !is_focused && Polygon_occluded(&clipped)) {
+    occluded_polygon_count++;
+    return;
+  }
+
+  if (visibility != 0) {
+    // Kept for shade_deferred, which shades the clipped polygon as is done below
+    PolygonShade *shade = &shade_records[visibility_figure_index(visibility)].polygons[visibility_primitive_index(visibility)];
+    shade->center = Polygon_center(&clipped);
+    shade->normal = Polygon_normal(&clipped);
+    draw_color = visibility;
+  } else {
+    v3 color = inherent_rgb;
+    if (DO_LIGHT_MODEL) {
+      PROFILE_BEGIN(stage_light);
+      color = Polygon_calc_color(&clipped, light_source_loc, color);
+      PROFILE_END(stage_light);
+    }
+    draw_rgb(color);
   }
-  G_rgbv(color);
 
   if (DO_POLY_FILL) {
-    Polygon_render_as_is(&clipped, zbuf, zrecord);
+    PROFILE_BEGIN(stage_raster);
+    if (!DO_EDGE_RASTER || !Polygon_rasterize(&clipped, zbuf, zrecord)) {
+      Polygon_render_as_is(&clipped, zbuf, zrecord);
+    }
+    PROFILE_END(stage_raster);
   }
 
   if (DO_WIREFRAME) {
     const int line_is_red = is_focused && !(DO_POLY_FILL && DO_HALO);
     const v3 line_color = line_is_red ? (v3) { 1, 0, 0 } : (v3) { .3, .3, .3 };
-    G_rgbv(line_color);
+    draw_rgb(line_color);
 
     for (int point_idx = 0; point_idx < clipped.length; point_idx++) {
       const v3 p0 = Polygon_get(&clipped, point_idx);
@@ -433,13 +677,13 @@ void zbuf_bounding_box(int *min_x, int *max_x, int *min_y, int *max_y, const Zbu
 
 void display_halo(Zbuf zbuf, Zbuf zrecord) {
 
-  G_rgb(1, 0, 0);
+  PROFILE_BEGIN(stage_halo);
+
+  draw_rgb((v3) { 1, 0, 0 });
 
   int min_x, max_x, min_y, max_y;
   zbuf_bounding_box(&min_x, &max_x, &min_y, &max_y, zrecord);
 
-  static const int halo_width = 5;
-
   for (int x = min_x; x <= max_x; x++) {
     for (int y = min_y; y <= max_y; y++) {
 
@@ -488,20 +732,95 @@ void display_halo(Zbuf zbuf, Zbuf zrecord) {
     }
   }
 
+  PROFILE_END(stage_halo);
+
 }
 
-void Polyhedron_render(const Polyhedron *polyhedron, const int is_focused, const v3 light_source_loc, Zbuf zbuf) {
+// Color of every polyhedron; mesh instances have their own
+const v3 polyhedron_rgb = { .8, .5, .8 };
 
-  Zbuf zrecord;
-  zbuf_init(zrecord);
+// Every pixel covered by the focused figure, from which its halo is found.
+// Only the main thread draws the focused figure, so one will do.
+Zbuf halo_zrecord;
 
-  for (int i = 0; i < polyhedron->length; i++) {
+void Polyhedron_render_range(
+  const Polyhedron *polyhedron,
+  const int polygon_lo,
+  const int polygon_hi,
+  const int is_focused,
+  const v3 light_source_loc,
+  Zbuf zbuf,
+  Zbuf zrecord
+) {
+  /* Render polygons polygon_lo through polygon_hi - 1 */
+  for (int i = polygon_lo; i < polygon_hi; i++) {
     const Polygon *polygon = Polyhedron_get(polyhedron, i);
-    if (shouldnt_render(polygon)) continue;
-    Polygon_render(polygon, is_focused, light_source_loc, zbuf, zrecord);
+    if (shouldnt_render(polygon)) {
+      PROFILE_COUNT(counter_polygons_culled, 1);
+      continue;
+    }
+    const unsigned int visibility = drawing_figure_index < 0 ? 0 : visibility_id(drawing_figure_index, i);
+    Polygon_render(polygon, is_focused, light_source_loc, polyhedron_rgb, visibility, zbuf, zrecord);
   }
+}
+
+void Polyhedron_render(const Polyhedron *polyhedron, const int is_focused, const v3 light_source_loc, Zbuf zbuf) {
 
+  float (*zrecord)[SCREEN_HEIGHT] = NULL;
   if (is_focused && DO_HALO) {
+    zrecord = halo_zrecord;
+    zbuf_init(zrecord);
+  }
+
+  Polyhedron_render_range(polyhedron, 0, polyhedron->length, is_focused, light_source_loc, zbuf, zrecord);
+
+  if (zrecord != NULL) {
+    display_halo(zbuf, zrecord);
+  }
+
+}
+
+// Each thread's memory for the mesh polygons placed by an instance,
+// which only last while one polygon is rendered
+_Thread_local Arena *placement_arena = NULL;
+
+void MeshInstance_render_range(
+  const MeshInstance *instance,
+  const int polygon_lo,
+  const int polygon_hi,
+  const int is_focused,
+  const v3 light_source_loc,
+  Zbuf zbuf,
+  Zbuf zrecord
+) {
+  /* Render polygons polygon_lo through polygon_hi - 1 of the instance's mesh */
+  if (placement_arena == NULL) placement_arena = Arena_new(1 << 12);
+
+  for (int i = polygon_lo; i < polygon_hi; i++) {
+    Arena_reset(placement_arena);
+    Polygon placed;
+    MeshInstance_place_polygon(&placed, instance, i, placement_arena);
+
+    if (shouldnt_render(&placed)) {
+      PROFILE_COUNT(counter_polygons_culled, 1);
+      continue;
+    }
+    const unsigned int visibility = drawing_figure_index < 0 ? 0 : visibility_id(drawing_figure_index, i);
+    Polygon_render(&placed, is_focused, light_source_loc, instance->color, visibility, zbuf, zrecord);
+  }
+}
+
+void MeshInstance_render(const MeshInstance *instance, const int is_focused, const v3 light_source_loc, Zbuf zbuf) {
+
+  float (*zrecord)[SCREEN_HEIGHT] = NULL;
+  if (is_focused && DO_HALO) {
+    zrecord = halo_zrecord;
+    zbuf_init(zrecord);
+  }
+
+  MeshInstance_render_range(instance, 0, instance->mesh->polyhedron->length, is_focused, light_source_loc, zbuf, zrecord);
+
+  if (zrecord != NULL) {
     display_halo(zbuf, zrecord);
   }
 
@@ -515,6 +834,15 @@ int point_in_bounds(const v3 point) {
   return 1;
 }
 
+v3 Lattice_calc_color(const Lattice *lattice, const int x, const int y, const v3 light_source_loc) {
+  const ColoredPoint clp = Lattice_get(lattice, x, y);
+  const v3 point = clp.position;
+  const v3 right_pt = Lattice_get(lattice, (x + 1) % lattice->width, y).position;
+  const v3 down_pt = Lattice_get(lattice, x, (y + 1) % lattice->height).position;
+  const v3 normal = v3_cross(down_pt - point, right_pt - point);
+  return calc_color(point, normal, light_source_loc, clp.color);
+}
+
 void Lattice_render(const Lattice *lattice, const int is_focused, const v3 light_source_loc, Zbuf zbuf) {
   for (int x = 0; x < lattice->width; x++) {
     for (int y = 0; y < lattice->height; y++) {
@@ -524,18 +852,15 @@ void Lattice_render(const Lattice *lattice, const int is_focused, const v3 light
 
       if (DO_CLIPPING && !point_in_bounds(point)) continue;
 
-      v3 color = clp.color;
       if (is_focused) {
         // if focused, make brighter
-        color = 1 - (color - 1) * (color - 1);
+        draw_rgb(1 - (clp.color - 1) * (clp.color - 1));
+      } else if (drawing_figure_index >= 0) {
+        draw_color = visibility_id(drawing_figure_index, y * lattice->width + x);
       } else {
         // else, apply lighting
-        const v3 right_pt = Lattice_get(lattice, (x + 1) % lattice->width, y).position;
-        const v3 down_pt = Lattice_get(lattice, x, (y + 1) % lattice->height).position;
-        const v3 normal = v3_cross(down_pt - point, right_pt - point);
-        color = calc_color(point, normal, light_source_loc, color);
+        draw_rgb(Lattice_calc_color(lattice, x, y, light_source_loc));
       }
-      G_rgbv(color);
 
       const v2 pixel = pixel_coords(point);
       zbuf_drawv(zbuf, pixel, point[2]);
@@ -584,8 +909,9 @@ int Intersector_z(v3 *result, const Intersector *intersector, const v2 pixel) {
   if (pixel[0] < 0 || pixel[0] >= SCREEN_WIDTH || pixel[1] < 0 || pixel[1] >= SCREEN_HEIGHT) {
     return 0;
   }
-  const Line *zline = pixel_coords_inv(pixel);
-  const int got_intersection = Intersector_intersect(result, intersector, zline);
+  Line zline;
+  pixel_coords_inv_line(&zline, pixel);
+  const int got_intersection = Intersector_intersect(result, intersector, &zline);
   return got_intersection;
 }
 
@@ -629,6 +955,18 @@ int Intersector_normal(v3 *result, const Intersector *intersector, const v3 poin
 
 }
 
+int Sdf_z(v3 *result, const Sdf *sdf, const v2 pixel) {
+  if (pixel[0] < 0 || pixel[0] >= SCREEN_WIDTH || pixel[1] < 0 || pixel[1] >= SCREEN_HEIGHT) {
+    return 0;
+  }
+  Line zline;
+  pixel_coords_inv_line(&zline, pixel);
+  return Sdf_intersect(result, sdf, &zline);
+}
+
+// Color of every intersector and SDF
+const v3 intersector_rgb = { .8, .5, .8 };
+
 v3 Intersector_calc_color(const Intersector *intersector, const v3 point, const v3 light_source_loc, const v3 inherent_rgb) {
   v3 normal;
   const int got_normal = Intersector_normal(&normal, intersector, point);
@@ -636,56 +974,320 @@ v3 Intersector_calc_color(const Intersector *intersector, const v3 point, const
   return calc_color(point, normal, light_source_loc, inherent_rgb);
 }
 
-void Intersector_render(Intersector *intersector, const int is_focused, const v3 light_source_loc, Zbuf zbuf) {
+// Intersectors are rendered in bands of INTERSECTOR_BLOCK columns, on
+// whichever workers of the thread pool are free. Each band finds its pixels
+// into spans of its own, which is the slow part, then depth-tests them into
+// the target. Bands have disjoint columns, so they never draw to the same pixel.
+//
+// With DO_ADAPTIVE_SAMPLING, bands are cut into INTERSECTOR_BLOCK-square
+// blocks, and only the corners of each block are sampled at first. A block
+// whose corners all miss is left empty, and one whose corners all hit with
+// close enough depths and normals (see SAMPLING_TOLERANCE) is filled by
+// interpolating between them. Any other block is split in four, down to
+// blocks small enough to be sampled at every pixel.
+#define INTERSECTOR_BLOCK 8
+
+// SDFs are rendered the same way, with sphere tracing in place of intersection.
+typedef struct {
+  // One of these is NULL
+  const Intersector *intersector;
+  const Sdf *sdf;
+  v3 light_source_loc;
+  float (*zbuf   )[SCREEN_HEIGHT];
+  float (*zrecord)[SCREEN_HEIGHT];
+  // Visibility id given to every pixel, or 0 if they're shaded as they're found
+  unsigned int visibility;
+  // Where hit points and normals are kept for shading, if there's a visibility id
+  const ShadeRecord *shade_record;
+  // Of the thread rendering the intersector
+  DrawState draw_state;
+  int px_lo;
+  int px_hi;
+  int py_lo;
+  int py_hi;
+} IntersectorPass;
+
+// What's seen at one pixel of an intersector
+typedef struct {
+  int hit;
+  int has_normal;
+  float z;
+  v3 point;
+  v3 normal;
+  v3 color;
+} IntersectorSample;
+
+typedef struct {
+  const IntersectorPass *pass;
+  // Band columns start at this pixel column
+  int px_lo;
+  float (*z)[SCREEN_HEIGHT];
+  unsigned int (*color)[SCREEN_HEIGHT];
+} IntersectorSpans;
+
+void IntersectorSample_take(IntersectorSample *sample, const IntersectorPass *pass, const int px, const int py) {
+  v3 intersection;
+  sample->hit = pass->sdf != NULL
+    ? Sdf_z(&intersection, pass->sdf, (v2) { px, py })
+    : Intersector_z(&intersection, pass->intersector, (v2) { px, py });
+  if (!sample->hit) return;
+
+  sample->z = intersection[2];
+  sample->point = intersection;
+  if (pass->visibility != 0) return;
+
+  sample->has_normal = pass->sdf != NULL
+    ? Sdf_normal(&sample->normal, pass->sdf, intersection)
+    : Intersector_normal(&sample->normal, pass->intersector, intersection);
+  sample->color = sample->has_normal
+    ? calc_color(intersection, sample->normal, pass->light_source_loc, intersector_rgb)
+    : intersector_rgb;
+}
 
-  if (is_focused && !DO_HALO)
-    G_rgb(1, 0, 0);
-  else
-    G_rgb(.8, .5, .8);
+int IntersectorSample_uniform(const IntersectorSample corners[4]) {
+  /* Are a block's corners alike enough for it to be interpolated? */
+  float z_lo = INFINITY;
+  float z_hi = -INFINITY;
+  for (int i = 0; i < 4; i++) {
+    if (!corners[i].hit || !corners[i].has_normal) return 0;
+    z_lo = fmin(z_lo, corners[i].z);
+    z_hi = fmax(z_hi, corners[i].z);
+  }
 
-  // First find pixel bounding box
+  // Depths relative to their distance, since far pixels cover more space
+  if (z_hi - z_lo > SAMPLING_TOLERANCE * z_lo) return 0;
 
-  v3 lows3, highs3;
-  Intersector_bounds_M(&lows3, &highs3, intersector);
+  for (int i = 1; i < 4; i++) {
+    if (v3_dot(corners[0].normal, corners[i].normal) < 1 - SAMPLING_TOLERANCE) return 0;
 
-  v2 lows2, highs2;
-  pixel_bounds_M(&lows2, &highs2, lows3, highs3);
+    // Specular highlights change color faster than the normal changes
+    const v3 color_diff = corners[i].color - corners[0].color;
+    for (int c = 0; c < 3; c++) {
+      if (fabs(color_diff[c]) > SAMPLING_TOLERANCE) return 0;
+    }
+  }
+  return 1;
+}
 
-  Zbuf zrecord;
-  zbuf_init(zrecord);
+void IntersectorSpans_put(const IntersectorSpans *spans, const int px, const int py, const IntersectorSample *sample) {
+  const IntersectorPass *pass = spans->pass;
+  if (px > pass->px_hi || py > pass->py_hi) return;
 
-  for (int px = lows2[0]; px <= highs2[0]; px++) {
-    for (int py = lows2[1]; py <= highs2[1]; py++) {
+  spans->z[px - spans->px_lo][py] = sample->hit ? sample->z : INFINITY;
+  if (!sample->hit) return;
 
-      v3 intersection;
-      const int got_intersection = Intersector_z(&intersection, intersector, (v2) { px, py });
-      if (!got_intersection) continue;
+  if (pass->visibility != 0) {
+    // Each pixel is sampled once, so is only ever written by this band
+    *ShadeRecord_point(pass->shade_record, px, py) = sample->point;
+    spans->color[px - spans->px_lo][py] = pass->visibility;
+  } else {
+    spans->color[px - spans->px_lo][py] = pack_rgb(sample->color);
+  }
+}
 
-      v3 color = { .8, .5, .8 };
-      color = Intersector_calc_color(intersector, intersection, light_source_loc, color);
-      G_rgbv(color);
+void IntersectorSpans_block(const IntersectorSpans *spans, const int px, const int py, const int size, const IntersectorSample corners[4]) {
+  /* Fill in the block of pixels from (px, py) to (px + size - 1, py + size - 1).
+     The corners are the samples at (px, py), (px + size, py), (px, py + size) and (px + size, py + size) */
+  const IntersectorPass *pass = spans->pass;
 
-      const float z = intersection[2];
-      zbuf_draw(zrecord, px, py, z);
-      zbuf_draw(zbuf, px, py, z);
+  if (!corners[0].hit && !corners[1].hit && !corners[2].hit && !corners[3].hit) {
+    const IntersectorSample miss = { .hit = 0 };
+    for (int x = px; x < px + size; x++) {
+      for (int y = py; y < py + size; y++) IntersectorSpans_put(spans, x, y, &miss);
+    }
+    return;
+  }
+
+  if (IntersectorSample_uniform(corners)) {
+    for (int x = px; x < px + size; x++) {
+      for (int y = py; y < py + size; y++) {
+        const float u = (float) (x - px) / size;
+        const float v = (float) (y - py) / size;
+        const float w[4] = { (1 - u) * (1 - v), u * (1 - v), (1 - u) * v, u * v };
+
+        IntersectorSample sample = { .hit = 1 };
+        sample.z = 0;
+        sample.color = v3_zero;
+        for (int i = 0; i < 4; i++) {
+          sample.z += w[i] * corners[i].z;
+          sample.color += w[i] * corners[i].color;
+        }
+        IntersectorSpans_put(spans, x, y, &sample);
+      }
+    }
+    return;
+  }
+
+  if (size <= 2) {
+    IntersectorSpans_put(spans, px, py, &corners[0]);
+    for (int x = px; x < px + size; x++) {
+      for (int y = py; y < py + size; y++) {
+        if (x == px && y == py) continue;
+        if (x > pass->px_hi || y > pass->py_hi) continue;
+        IntersectorSample sample;
+        IntersectorSample_take(&sample, pass, x, y);
+        IntersectorSpans_put(spans, x, y, &sample);
+      }
+    }
+    return;
+  }
+
+  // Split in four, sampling the edge midpoints and the middle
+  const int half = size / 2;
+  IntersectorSample top, left, middle, right, bottom;
+  IntersectorSample_take(&top   , pass, px + half, py       );
+  IntersectorSample_take(&left  , pass, px       , py + half);
+  IntersectorSample_take(&middle, pass, px + half, py + half);
+  IntersectorSample_take(&right , pass, px + size, py + half);
+  IntersectorSample_take(&bottom, pass, px + half, py + size);
+
+  const IntersectorSample top_left    [4] = { corners[0], top       , left      , middle     };
+  const IntersectorSample top_right   [4] = { top       , corners[1], middle    , right      };
+  const IntersectorSample bottom_left [4] = { left      , middle    , corners[2], bottom     };
+  const IntersectorSample bottom_right[4] = { middle    , right     , bottom    , corners[3] };
+
+  IntersectorSpans_block(spans, px       , py       , half, top_left    );
+  IntersectorSpans_block(spans, px + half, py       , half, top_right   );
+  IntersectorSpans_block(spans, px       , py + half, half, bottom_left );
+  IntersectorSpans_block(spans, px + half, py + half, half, bottom_right);
+}
 
+void Intersector_render_band(void *arg, const int band_lo, const int band_hi) {
+  /* Render bands band_lo through band_hi - 1 of the pass's intersector */
+  const IntersectorPass *pass = arg;
+  render_profile_worker();
+
+  float span_z[INTERSECTOR_BLOCK][SCREEN_HEIGHT];
+  unsigned int span_color[INTERSECTOR_BLOCK][SCREEN_HEIGHT];
+
+  for (int band_i = band_lo; band_i < band_hi; band_i++) {
+    const int px_lo = pass->px_lo + band_i * INTERSECTOR_BLOCK;
+    const int px_hi = min(px_lo + INTERSECTOR_BLOCK - 1, pass->px_hi);
+    const IntersectorSpans spans = { pass, px_lo, span_z, span_color };
+
+    if (DO_ADAPTIVE_SAMPLING) {
+      // Corners shared with the block above are carried down
+      IntersectorSample corners[4];
+      IntersectorSample_take(&corners[2], pass, px_lo                    , pass->py_lo);
+      IntersectorSample_take(&corners[3], pass, px_lo + INTERSECTOR_BLOCK, pass->py_lo);
+
+      for (int py = pass->py_lo; py <= pass->py_hi; py += INTERSECTOR_BLOCK) {
+        corners[0] = corners[2];
+        corners[1] = corners[3];
+        IntersectorSample_take(&corners[2], pass, px_lo                    , py + INTERSECTOR_BLOCK);
+        IntersectorSample_take(&corners[3], pass, px_lo + INTERSECTOR_BLOCK, py + INTERSECTOR_BLOCK);
+        IntersectorSpans_block(&spans, px_lo, py, INTERSECTOR_BLOCK, corners);
+      }
+    } else {
+      for (int px = px_lo; px <= px_hi; px++) {
+        for (int py = pass->py_lo; py <= pass->py_hi; py++) {
+          IntersectorSample sample;
+          IntersectorSample_take(&sample, pass, px, py);
+          IntersectorSpans_put(&spans, px, py, &sample);
+        }
+      }
+    }
+
+    const DrawState own_state = draw_state_save();
+    draw_state_restore(pass->draw_state);
+
+    for (int px = px_lo; px <= px_hi; px++) {
+      for (int py = pass->py_lo; py <= pass->py_hi; py++) {
+        const float z = span_z[px - px_lo][py];
+        if (z == INFINITY) continue;
+
+        draw_color = span_color[px - px_lo][py];
+        if (pass->zrecord != NULL) zbuf_draw(pass->zrecord, px, py, z);
+        zbuf_draw(pass->zbuf, px, py, z);
+      }
     }
+
+    draw_state_restore(own_state);
   }
+}
+
+void IntersectorPass_render(IntersectorPass *pass, const v3 lows3, const v3 highs3, const int is_focused, const v3 light_source_loc, Zbuf zbuf) {
+  /* Render the pass's intersector or SDF, whose eye-space bounds are given */
+
+  if (is_focused && !DO_HALO)
+    draw_rgb((v3) { 1, 0, 0 });
+  else
+    draw_rgb((v3) { .8, .5, .8 });
+
+  // First find pixel bounding box
+
+  v2 lows2, highs2;
+  pixel_bounds_M(&lows2, &highs2, lows3, highs3);
 
+  float (*zrecord)[SCREEN_HEIGHT] = NULL;
   if (is_focused && DO_HALO) {
-    G_rgb(1, 0, 0);
+    zrecord = halo_zrecord;
+    zbuf_init(zrecord);
+  }
+
+  // Adaptive sampling interpolates colors, so has them found as it goes
+  pass->visibility = is_focused || drawing_figure_index < 0 || DO_ADAPTIVE_SAMPLING ? 0 : visibility_id(drawing_figure_index, 0);
+  pass->shade_record = pass->visibility != 0 ? &shade_records[drawing_figure_index] : NULL;
+
+  // The shade record covers the figure's part of draw_clip, but no more
+  const ScreenRect clip = pass->visibility != 0 ? ScreenRect_intersect(draw_clip, pass->shade_record->rect) : draw_clip;
+
+  const int px_lo = fmax(lows2[0] , clip.x_lo);
+  const int px_hi = fmin(highs2[0], clip.x_hi);
+  const int py_lo = fmax(lows2[1] , clip.y_lo);
+  const int py_hi = fmin(highs2[1], clip.y_hi);
+
+  pass->light_source_loc = light_source_loc;
+  pass->zbuf = zbuf;
+  pass->zrecord = zrecord;
+  pass->draw_state = draw_state_save();
+  pass->px_lo = px_lo;
+  pass->px_hi = px_hi;
+  pass->py_lo = py_lo;
+  pass->py_hi = py_hi;
+
+  // draw_clip is within the screen, so the spans are big enough
+  const int band_count = px_hi < px_lo ? 0 : (px_hi - px_lo) / INTERSECTOR_BLOCK + 1;
+
+  // When this is one of the layer's jobs, the bands are drawn into this worker's
+  // buffers, by whichever workers take them. Were this worker to take another
+  // job while it waited, it would draw that into the same buffers at the same time.
+  parallel_for_isolated(0, band_count, 1, Intersector_render_band, pass);
+
+  if (zrecord != NULL) {
+    draw_rgb((v3) { 1, 0, 0 });
     display_halo(zbuf, zrecord);
   }
 
 }
 
+void Intersector_render(Intersector *intersector, const int is_focused, const v3 light_source_loc, Zbuf zbuf) {
+  IntersectorPass pass;
+  pass.intersector = intersector;
+  pass.sdf = NULL;
+
+  v3 lows3, highs3;
+  Intersector_bounds_M(&lows3, &highs3, intersector);
+  IntersectorPass_render(&pass, lows3, highs3, is_focused, light_source_loc, zbuf);
+}
+
+void Sdf_render(const Sdf *sdf, const int is_focused, const v3 light_source_loc, Zbuf zbuf) {
+  IntersectorPass pass;
+  pass.intersector = NULL;
+  pass.sdf = sdf;
+
+  v3 lows3, highs3;
+  Sdf_bounds_M(&lows3, &highs3, sdf);
+  IntersectorPass_render(&pass, lows3, highs3, is_focused, light_source_loc, zbuf);
+}
+
 void Observer_render(const Observer *observer, const int is_focused, const v3 light_source_loc, const Zbuf zbuf) {
   return;
 }
 
 void render_bounds(const Figure *figure, Zbuf zbuf) {
 
-  G_rgb(0, 1, 0);
+  draw_rgb((v3) { 0, 1, 0 });
 
   v3 lows;
   v3 highs;
@@ -725,13 +1327,642 @@ void Figure_render(const Figure *figure, const int is_focused, const v3 light_so
     case fk_Polyhedron : return Polyhedron_render (figure->impl.polyhedron , is_focused, light_source_loc, zbuf);
     case fk_Lattice    : return Lattice_render    (figure->impl.lattice    , is_focused, light_source_loc, zbuf);
     case fk_Intersector: return Intersector_render(figure->impl.intersector, is_focused, light_source_loc, zbuf);
+    case fk_Sdf        : return Sdf_render        (figure->impl.sdf        , is_focused, light_source_loc, zbuf);
+    case fk_MeshInstance: return MeshInstance_render(figure->impl.mesh_instance, is_focused, light_source_loc, zbuf);
     case fk_Observer   : return Observer_render   (figure->impl.observer   , is_focused, light_source_loc, zbuf);
   }
 }
 
 
 
-void render_figures(Figure *figures[], const int figure_count, const Figure *focused_figure, const Observer *observer, const Figure *light_source) {
+int screen_rect_M(ScreenRect *rect, const v3 lows, const v3 highs) {
+  /* Find the pixel rectangle covering a 3D bounding box.
+   * Returns 0 if the box reaches to or behind the eye, where projection breaks down */
+
+  if (lows[2] <= 0) return 0;
+
+  float min_px = +INFINITY;
+  float max_px = -INFINITY;
+  float min_py = +INFINITY;
+  float max_py = -INFINITY;
+
+  for (int corner_idx = 0; corner_idx < 8; corner_idx++) {
+    const v3 corner = {
+      (corner_idx & 1) ? highs[0] : lows[0],
+      (corner_idx & 2) ? highs[1] : lows[1],
+      (corner_idx & 4) ? highs[2] : lows[2]
+    };
+    const v2 pixel = pixel_coords(corner);
+    if (pixel[0] < min_px) min_px = pixel[0];
+    if (pixel[0] > max_px) max_px = pixel[0];
+    if (pixel[1] < min_py) min_py = pixel[1];
+    if (pixel[1] > max_py) max_py = pixel[1];
+  }
+
+  rect->x_lo = (int) clamp(floor(min_px), -1, SCREEN_WIDTH );
+  rect->x_hi = (int) clamp( ceil(max_px), -1, SCREEN_WIDTH );
+  rect->y_lo = (int) clamp(floor(min_py), -1, SCREEN_HEIGHT);
+  rect->y_hi = (int) clamp( ceil(max_py), -1, SCREEN_HEIGHT);
+  return 1;
+}
+
+// A figure brought into eye space, ready to be drawn
+typedef struct {
+  // Eye-space copy of the figure, owned by the frame
+  Figure *figure;
+  // Index of the original among the rendered figures
+  int index;
+  int is_focused;
+
+  // Nearest z-value of the figure's bounds
+  float near_z;
+
+  // Pixel rectangle covered by the figure and its halo, if known
+  int has_rect;
+  ScreenRect rect;
+} EyeFigure;
+
+void EyeFigure_init(EyeFigure *eye_figure, const Figure *figure, const int index, const int is_focused, const _Mat to_eyespace) {
+  // Transform a copy so that the figure itself stays in world space
+  PROFILE_BEGIN(stage_eyespace);
+  eye_figure->figure = Figure_clone_in(figure, frame_arena);
+  Figure_transform(eye_figure->figure, to_eyespace);
+  PROFILE_END(stage_eyespace);
+  eye_figure->index = index;
+  eye_figure->is_focused = is_focused;
+
+  v3 lows, highs;
+  Figure_bounds_M(&lows, &highs, eye_figure->figure);
+  eye_figure->near_z = lows[2];
+  eye_figure->has_rect = screen_rect_M(&eye_figure->rect, lows, highs);
+  eye_figure->rect = ScreenRect_pad(eye_figure->rect, halo_width);
+}
+
+int EyeFigure_compare_near_z(const void *a, const void *b) {
+  const float za = ((const EyeFigure *) a)->near_z;
+  const float zb = ((const EyeFigure *) b)->near_z;
+  return (za > zb) - (za < zb);
+}
+
+
+// == Deferred shading == //
+
+// (see "Visibility ids" above)
+
+int Figure_primitive_count(const Figure *figure) {
+  /* Number of primitives a figure's visibility ids may name */
+  switch (figure->kind) {
+    case fk_Polyhedron: return figure->impl.polyhedron->length;
+    case fk_MeshInstance: return figure->impl.mesh_instance->mesh->polyhedron->length;
+    case fk_Lattice: return figure->impl.lattice->width * figure->impl.lattice->height;
+    default: return 1;
+  }
+}
+
+int visibility_begin(const EyeFigure to_draw[], const int draw_count, const int figure_count, const ScreenRect damage) {
+  /* Set out visibility ids and shade records for drawing the given figures
+     into the damaged region. Returns 0 if the ids don't fit */
+  int figure_bits = 0;
+  while ((1 << figure_bits) < figure_count) figure_bits++;
+  visibility_primitive_bits = 31 - figure_bits;
+
+  for (int draw_i = 0; draw_i < draw_count; draw_i++) {
+    const int primitive_count = Figure_primitive_count(to_draw[draw_i].figure);
+    if (primitive_count - 1 > (int) ((1u << visibility_primitive_bits) - 1)) return 0;
+  }
+
+  // Figures are drawn on many threads at once, so their memory is set out beforehand
+  shade_records = Arena_alloc(frame_arena, figure_count * sizeof(ShadeRecord));
+  for (int draw_i = 0; draw_i < draw_count; draw_i++) {
+    const EyeFigure *eye_figure = &to_draw[draw_i];
+    ShadeRecord *record = &shade_records[eye_figure->index];
+    record->polygons = NULL;
+    record->points = NULL;
+    record->rect = eye_figure->has_rect ? ScreenRect_intersect(eye_figure->rect, damage) : damage;
+
+    switch (eye_figure->figure->kind) {
+      case fk_Polyhedron:
+      case fk_MeshInstance:
+        record->polygons = Arena_alloc(frame_arena, Figure_primitive_count(eye_figure->figure) * sizeof(PolygonShade));
+        break;
+
+      case fk_Intersector:
+      case fk_Sdf:
+        if (ScreenRect_is_empty(record->rect)) break;
+        const int area = (record->rect.x_hi - record->rect.x_lo + 1) * (record->rect.y_hi - record->rect.y_lo + 1);
+        record->points = Arena_alloc(frame_arena, area * sizeof(v3));
+        break;
+
+      default:
+        break;
+    }
+  }
+  return 1;
+}
+
+typedef struct {
+  // By figure index
+  const EyeFigure *eye_figures;
+  v3 light_source_loc;
+  ScreenRect rect;
+} ShadePass;
+
+int shade_visible_M(unsigned int *color, const ShadePass *pass, const unsigned int id, const int x, const int y) {
+  /* Find the color of the layer's pixel (x, y), which shows the given visibility id.
+     Returns 1 if it's the color of every pixel with that id */
+  const int figure_i = visibility_figure_index(id);
+  const Figure *figure = pass->eye_figures[figure_i].figure;
+  const ShadeRecord *record = &shade_records[figure_i];
+  const int primitive_i = visibility_primitive_index(id);
+
+  switch (figure->kind) {
+    case fk_Polyhedron:
+    case fk_MeshInstance: {
+      // Polygons are flat-shaded, as in Polygon_render
+      const PolygonShade *shade = &record->polygons[primitive_i];
+      v3 rgb = figure->kind == fk_Polyhedron ? polyhedron_rgb : figure->impl.mesh_instance->color;
+      if (DO_LIGHT_MODEL) rgb = calc_color(shade->center, shade->normal, pass->light_source_loc, rgb);
+      *color = pack_rgb(rgb);
+      return 1;
+    }
+
+    case fk_Lattice: {
+      const Lattice *lattice = figure->impl.lattice;
+      *color = pack_rgb(Lattice_calc_color(lattice, primitive_i % lattice->width, primitive_i / lattice->width, pass->light_source_loc));
+      return 1;
+    }
+
+    case fk_Intersector:
+    case fk_Sdf: {
+      // The normal is only worth finding now, once the point is known to be seen
+      const v3 point = *ShadeRecord_point(record, x, y);
+      v3 normal;
+      const int has_normal = figure->kind == fk_Sdf
+        ? Sdf_normal(&normal, figure->impl.sdf, point)
+        : Intersector_normal(&normal, figure->impl.intersector, point);
+      *color = pack_rgb(has_normal ? calc_color(point, normal, pass->light_source_loc, intersector_rgb) : intersector_rgb);
+      return 0;
+    }
+
+    default:
+      *color = pack_rgb(v3_zero);
+      return 1;
+  }
+}
+
+void shade_deferred_task(void *arg, const int lo, const int hi) {
+  /* Shade the pass's pixels of the layer in columns lo through hi - 1 */
+  const ShadePass *pass = arg;
+  render_profile_worker();
+  PROFILE_BEGIN(stage_light);
+
+  for (int x = lo; x < hi; x++) {
+    // Pixels down a column often show the same polygon, which need only be shaded once
+    unsigned int last_id = 0;
+    unsigned int last_color = 0;
+
+    for (int y = pass->rect.y_lo; y <= pass->rect.y_hi; y++) {
+      const unsigned int id = layer_color[x][y];
+      if (!(id & VISIBILITY_FLAG)) continue;
+
+      if (id != last_id) {
+        unsigned int color;
+        const int is_flat = shade_visible_M(&color, pass, id, x, y);
+        last_id = is_flat ? id : 0;
+        last_color = color;
+      }
+      layer_color[x][y] = last_color;
+    }
+  }
+
+  PROFILE_END(stage_light);
+}
+
+void shade_deferred(const EyeFigure eye_figures[], const ScreenRect rect, const v3 light_source_loc) {
+  /* Replace the visibility ids within the given rectangle of the layer with colors */
+  ShadePass pass;
+  pass.eye_figures = eye_figures;
+  pass.light_source_loc = light_source_loc;
+  pass.rect = rect;
+  parallel_for(rect.x_lo, rect.x_hi + 1, 0, shade_deferred_task, &pass);
+}
+
+
+// == Damage tracking == //
+
+// Renders keep two sets of buffers (see draw.c): the layer, holding every
+// figure but the focused one, and the frame, which is the layer with the
+// focused figure drawn over it. Both persist between renders, and only the
+// regions covered by figures which changed (where they were, and where
+// they are now) are redrawn.
+//
+// So while the focused figure is manipulated, the frame around it is
+// restored from the layer and it alone is drawn again, however large
+// the rest of the scene is. The layer is only patched when some other
+// figure changes, and only redrawn whole when the view does.
+
+// Everything besides the figures which the image depends on.
+// If any of it changes, everything is redrawn.
+typedef struct {
+  _Mat to_eyespace;
+  float light_source_loc[3];
+
+  float half_angle;
+  float ambient;
+  float diffuse_max;
+  int   specular_power;
+  float hither;
+  float yon;
+  float sampling_tolerance;
+
+  int do_wireframe;
+  int do_backface_elimination;
+  int backface_elimination_sign;
+  int do_halo;
+  int do_clipping;
+  int do_bounding_boxes;
+  int do_poly_fill;
+  int do_light_model;
+  int do_adaptive_sampling;
+  int do_edge_raster;
+  int do_deferred_shading;
+} RenderSettings;
+
+void RenderSettings_capture(RenderSettings *settings, const _Mat to_eyespace, const v3 light_source_loc) {
+  // Zero the padding too, since settings are compared with memcmp
+  memset(settings, 0, sizeof(RenderSettings));
+
+  Mat_clone_M(settings->to_eyespace, to_eyespace);
+  for (int i = 0; i < 3; i++) settings->light_source_loc[i] = light_source_loc[i];
+
+  settings->half_angle                = HALF_ANGLE;
+  settings->ambient                   = AMBIENT;
+  settings->diffuse_max               = DIFFUSE_MAX;
+  settings->specular_power            = SPECULAR_POWER;
+  settings->hither                    = HITHER;
+  settings->yon                       = YON;
+  settings->sampling_tolerance        = SAMPLING_TOLERANCE;
+
+  settings->do_wireframe              = DO_WIREFRAME;
+  settings->do_backface_elimination   = DO_BACKFACE_ELIMINATION;
+  settings->backface_elimination_sign = BACKFACE_ELIMINATION_SIGN;
+  settings->do_halo                   = DO_HALO;
+  settings->do_clipping               = DO_CLIPPING;
+  settings->do_bounding_boxes         = DO_BOUNDING_BOXES;
+  settings->do_poly_fill              = DO_POLY_FILL;
+  settings->do_light_model            = DO_LIGHT_MODEL;
+  settings->do_adaptive_sampling      = DO_ADAPTIVE_SAMPLING;
+  settings->do_edge_raster            = DO_EDGE_RASTER;
+  settings->do_deferred_shading       = DO_DEFERRED_SHADING;
+}
+
+// A figure as it was when last drawn
+typedef struct {
+  const Figure *figure;
+  unsigned long version;
+  // Was it drawn to the layer, or (being focused) only to the frame?
+  int in_layer;
+  // Was it left out, being culled? Its rectangle is then empty
+  int culled;
+  int has_rect;
+  ScreenRect rect;
+} FrameRecord;
+
+FrameRecord *frame_records = NULL;
+int frame_record_count = 0;
+RenderSettings frame_settings;
+int frame_valid = 0;
+
+// Pixels in the regions redrawn by the last render
+long redrawn_pixel_count = 0;
+long redrawn_layer_pixel_count = 0;
+
+void render_invalidate() {
+  /* Make the next render redraw everything */
+  frame_valid = 0;
+}
+
+ScreenRect damage_union(const ScreenRect damage, const int had_rect, const ScreenRect rect) {
+  /* Add a figure's rectangle to a damaged region. Without a rectangle it may cover anything */
+  return had_rect ? ScreenRect_union(damage, rect) : screen_rect();
+}
+
+
+// == Parallel layer rendering == //
+
+// With DO_PARALLEL_RENDER, the figures to be drawn into the layer are
+// shared out among the workers of the thread pool. Each worker draws the
+// figures it takes into buffers of its own, clearing only the rectangles
+// those figures cover. Then the buffers are merged into the layer by
+// keeping the nearest depth at each pixel, in parallel bands of columns.
+// Large polyhedra are split into chunks of polygons so that a single big
+// model doesn't leave the other workers idle.
+//
+// Figures are drawn in batches, in the order they're given (front to back,
+// with DO_OCCLUSION_CULLING), and each batch is merged into the layer and
+// the hierarchical z-buffer before the next starts, so that what it hides
+// can be culled. The first batch has a job for each worker and each one
+// after has twice as many, so the nearest figures, which hide the most, go
+// in early without there being many batches.
+//
+// Drawing only goes through draw_rgb and zbuf_draw, whose state is
+// per-thread (see draw.c); nothing run on the workers may call libgfx.
+
+// Number of polygons in each chunk of a split-up polyhedron
+const int render_chunk_polygons = 1024;
+
+// A figure, or some of a polyhedron's polygons, to be drawn by any worker
+typedef struct {
+  const EyeFigure *eye_figure;
+  // Polygons polygon_lo through polygon_hi - 1, or the whole figure if polygon_hi < 0
+  int polygon_lo;
+  int polygon_hi;
+  // Pixels the job may draw to
+  ScreenRect rect;
+} RenderJob;
+
+typedef struct {
+  Zbuf zbuf;
+  Colorbuf color;
+  // Union of the rectangles drawn to in this pass, all of which have been cleared
+  ScreenRect touched;
+} RenderBuffers;
+
+// Each worker's buffers, allocated when first needed
+RenderBuffers *render_buffers[POOL_MAX_WORKERS];
+
+
+typedef struct {
+  const RenderJob *jobs;
+  v3 light_source_loc;
+  // Region drawn to by the batch of jobs, to be merged into the layer
+  ScreenRect damage;
+  int is_deferred;
+} RenderPass;
+
+void RenderBuffers_extend(RenderBuffers *buffers, const ScreenRect rect) {
+  /* Clear whatever of rect isn't yet, and add it to the touched region */
+  const ScreenRect old = buffers->touched;
+  const ScreenRect new = ScreenRect_union(old, rect);
+
+  if (ScreenRect_is_empty(old)) {
+    buffers_clear(buffers->zbuf, buffers->color, new);
+  } else {
+    // new contains old, so what's left is a strip on each side
+    buffers_clear(buffers->zbuf, buffers->color, (ScreenRect) { new.x_lo    , old.x_lo - 1, new.y_lo    , new.y_hi     });
+    buffers_clear(buffers->zbuf, buffers->color, (ScreenRect) { old.x_hi + 1, new.x_hi    , new.y_lo    , new.y_hi     });
+    buffers_clear(buffers->zbuf, buffers->color, (ScreenRect) { old.x_lo    , old.x_hi    , new.y_lo    , old.y_lo - 1 });
+    buffers_clear(buffers->zbuf, buffers->color, (ScreenRect) { old.x_lo    , old.x_hi    , old.y_hi + 1, new.y_hi     });
+  }
+
+  buffers->touched = new;
+}
+
+void RenderBuffers_merge(Zbuf zbuf, Colorbuf color, const RenderBuffers *buffers, const ScreenRect band) {
+  /* Depth-test the buffers' pixels within band into zbuf and color */
+  const ScreenRect rect = ScreenRect_intersect(buffers->touched, band);
+  if (ScreenRect_is_empty(rect)) return;
+
+  PROFILE_BEGIN(stage_compose);
+  for (int x = rect.x_lo; x <= rect.x_hi; x++) {
+    for (int y = rect.y_lo; y <= rect.y_hi; y++) {
+      if (buffers->zbuf[x][y] < zbuf[x][y]) {
+        zbuf[x][y] = buffers->zbuf[x][y];
+        color[x][y] = buffers->color[x][y];
+      }
+    }
+  }
+  PROFILE_END(stage_compose);
+}
+
+int RenderJob_polygon_count(const Figure *figure) {
+  /* Number of polygons a figure is drawn as, or 0 if it isn't drawn as polygons */
+  switch (figure->kind) {
+    case fk_Polyhedron: return figure->impl.polyhedron->length;
+    case fk_MeshInstance: return figure->impl.mesh_instance->mesh->polyhedron->length;
+    default: return 0;
+  }
+}
+
+int RenderJob_chunk_count(const Figure *figure) {
+  /* Number of jobs a figure is split into */
+  const int polygon_count = RenderJob_polygon_count(figure);
+  if (polygon_count <= render_chunk_polygons) return 1;
+  return (polygon_count + render_chunk_polygons - 1) / render_chunk_polygons;
+}
+
+void RenderJob_render(const RenderJob *job, const v3 light_source_loc, Zbuf zbuf) {
+  const Figure *figure = job->eye_figure->figure;
+
+  if (job->polygon_hi < 0) {
+    Figure_render(figure, 0, light_source_loc, zbuf);
+    return;
+  }
+
+  if (DO_BOUNDING_BOXES && job->polygon_lo == 0) render_bounds(figure, zbuf);
+  if (figure->kind == fk_MeshInstance) {
+    MeshInstance_render_range(figure->impl.mesh_instance, job->polygon_lo, job->polygon_hi, 0, light_source_loc, zbuf, NULL);
+  } else {
+    Polyhedron_render_range(figure->impl.polyhedron, job->polygon_lo, job->polygon_hi, 0, light_source_loc, zbuf, NULL);
+  }
+}
+
+void render_jobs_task(void *arg, const int lo, const int hi) {
+  /* Draw jobs lo through hi - 1 into the calling worker's buffers */
+  const RenderPass *pass = arg;
+  const int worker_i = pool_worker_index();
+
+  if (render_buffers[worker_i] == NULL) {
+    render_buffers[worker_i] = malloc(sizeof(RenderBuffers));
+    render_buffers[worker_i]->touched = empty_rect;
+  }
+  RenderBuffers *buffers = render_buffers[worker_i];
+
+  render_profile_worker();
+
+  // This worker may be in the middle of drawing something else,
+  // if it picked up these jobs while waiting for its own tasks
+  const DrawState own_state = draw_state_save();
+  const int own_figure_index = drawing_figure_index;
+
+  draw_target_set(buffers->zbuf, buffers->color);
+  for (int job_i = lo; job_i < hi; job_i++) {
+    const RenderJob *job = &pass->jobs[job_i];
+    RenderBuffers_extend(buffers, job->rect);
+    draw_clip = job->rect;
+    drawing_figure_index = pass->is_deferred ? job->eye_figure->index : -1;
+    RenderJob_render(job, pass->light_source_loc, buffers->zbuf);
+  }
+
+  draw_state_restore(own_state);
+  drawing_figure_index = own_figure_index;
+}
+
+void render_merge_task(void *arg, const int lo, const int hi) {
+  /* Merge columns lo through hi - 1 of every worker's buffers into the layer */
+  const RenderPass *pass = arg;
+  ScreenRect band = pass->damage;
+  band.x_lo = lo;
+  band.x_hi = hi - 1;
+
+  for (int worker_i = 0; worker_i < POOL_MAX_WORKERS; worker_i++) {
+    if (render_buffers[worker_i] == NULL) continue;
+    RenderBuffers_merge(layer_zbuf, layer_color, render_buffers[worker_i], band);
+  }
+}
+
+void render_layer_parallel(EyeFigure *to_draw, const int draw_count, const ScreenRect damage, const int is_deferred, const v3 light_source_loc) {
+  /* Draw figures into the damaged region of the layer, which has been cleared */
+
+  int max_job_count = 0;
+  for (int draw_i = 0; draw_i < draw_count; draw_i++) {
+    max_job_count += RenderJob_chunk_count(to_draw[draw_i].figure);
+  }
+
+  // Enough for any batch
+  RenderJob *jobs = Arena_alloc(frame_arena, max_job_count * sizeof(RenderJob));
+
+  RenderPass pass;
+  pass.jobs = jobs;
+  pass.light_source_loc = light_source_loc;
+  pass.is_deferred = is_deferred;
+
+  int batch_size = pool_worker_count();
+  int draw_i = 0;
+
+  while (draw_i < draw_count) {
+    // Split the batch's figures into jobs
+    int job_count = 0;
+    ScreenRect batch_rect = empty_rect;
+
+    while (draw_i < draw_count && job_count < batch_size) {
+      const EyeFigure *eye_figure = &to_draw[draw_i++];
+      const ScreenRect rect = eye_figure->has_rect ? ScreenRect_intersect(eye_figure->rect, damage) : damage;
+
+      if (   DO_OCCLUSION_CULLING
+          && eye_figure->has_rect
+          && hiz_occludes(rect.x_lo, rect.x_hi, rect.y_lo, rect.y_hi, eye_figure->near_z)
+      ) {
+        occluded_figure_count++;
+        continue;
+      }
+
+      const int chunk_count = RenderJob_chunk_count(eye_figure->figure);
+      for (int chunk_i = 0; chunk_i < chunk_count; chunk_i++) {
+        RenderJob *job = &jobs[job_count++];
+        job->eye_figure = eye_figure;
+        job->rect = rect;
+        if (chunk_count == 1) {
+          job->polygon_lo = 0;
+          job->polygon_hi = -1;
+        } else {
+          job->polygon_lo = chunk_i * render_chunk_polygons;
+          job->polygon_hi = min(RenderJob_polygon_count(eye_figure->figure), (chunk_i + 1) * render_chunk_polygons);
+        }
+      }
+      batch_rect = ScreenRect_union(batch_rect, rect);
+    }
+    batch_size *= 2;
+
+    if (job_count == 0) continue;
+
+    for (int worker_i = 0; worker_i < POOL_MAX_WORKERS; worker_i++) {
+      if (render_buffers[worker_i] != NULL) render_buffers[worker_i]->touched = empty_rect;
+    }
+
+    // Jobs are big enough to be worth handing out one at a time
+    pass.damage = batch_rect;
+    parallel_for(0, job_count, 1, render_jobs_task, &pass);
+    parallel_for(batch_rect.x_lo, batch_rect.x_hi + 1, 0, render_merge_task, &pass);
+
+    if (DO_OCCLUSION_CULLING) hiz_update(layer_zbuf, batch_rect.x_lo, batch_rect.x_hi, batch_rect.y_lo, batch_rect.y_hi);
+  }
+
+  draw_target_set(layer_zbuf, layer_color);
+  draw_clip = damage;
+}
+
+void render_layer(
+  EyeFigure eye_figures[],
+  Figure *figures[],
+  const int figure_count,
+  const ScreenRect damage,
+  const int redraw_all,
+  const _Mat to_eyespace,
+  const v3 light_source_loc
+) {
+  /* Redraw the damaged region of the layer */
+
+  draw_target_set(layer_zbuf, layer_color);
+  draw_clip = damage;
+
+  buffers_clear(layer_zbuf, layer_color, damage);
+  if (redraw_all) {
+    hiz_init();
+  } else {
+    hiz_update(layer_zbuf, damage.x_lo, damage.x_hi, damage.y_lo, damage.y_hi);
+  }
+
+  // Gather the figures which may draw into the damaged region
+  EyeFigure *to_draw = Arena_alloc(frame_arena, figure_count * sizeof(EyeFigure));
+  int draw_count = 0;
+
+  for (int figure_i = 0; figure_i < figure_count; figure_i++) {
+    const FrameRecord *record = &frame_records[figure_i];
+    if (!record->in_layer || record->culled) continue;
+    if (record->has_rect && ScreenRect_is_empty(ScreenRect_intersect(record->rect, damage))) continue;
+
+    EyeFigure *eye_figure = &eye_figures[figure_i];
+    if (eye_figure->figure == NULL) {
+      EyeFigure_init(eye_figure, figures[figure_i], figure_i, 0, to_eyespace);
+    }
+    to_draw[draw_count++] = *eye_figure;
+  }
+
+  // Drawing roughly front-to-back lets near figures hide far ones
+  if (DO_OCCLUSION_CULLING) {
+    qsort(to_draw, draw_count, sizeof(EyeFigure), EyeFigure_compare_near_z);
+  }
+
+  const int is_deferred = DO_DEFERRED_SHADING && visibility_begin(to_draw, draw_count, figure_count, damage);
+
+  // Heatmaps record the drawing as it happens, so need it done in order
+  if (DO_PARALLEL_RENDER && heatmap_mode == heatmap_off && pool_worker_count() > 1 && draw_count > 0) {
+    render_layer_parallel(to_draw, draw_count, damage, is_deferred, light_source_loc);
+    if (is_deferred) shade_deferred(eye_figures, damage, light_source_loc);
+    return;
+  }
+
+  for (int draw_i = 0; draw_i < draw_count; draw_i++) {
+    const EyeFigure *eye_figure = &to_draw[draw_i];
+    const ScreenRect rect = eye_figure->has_rect ? ScreenRect_intersect(eye_figure->rect, damage) : damage;
+
+    if (   DO_OCCLUSION_CULLING
+        && eye_figure->has_rect
+        && hiz_occludes(rect.x_lo, rect.x_hi, rect.y_lo, rect.y_hi, eye_figure->near_z)
+    ) {
+      occluded_figure_count++;
+      continue;
+    }
+
+    if (heatmap_mode != heatmap_off) heatmap_begin_figure(eye_figure->index);
+    drawing_figure_index = is_deferred ? eye_figure->index : -1;
+    Figure_render(eye_figure->figure, 0, light_source_loc, layer_zbuf);
+    drawing_figure_index = -1;
+    if (heatmap_mode != heatmap_off) heatmap_end_figure();
+
+    if (DO_OCCLUSION_CULLING) hiz_update(layer_zbuf, rect.x_lo, rect.x_hi, rect.y_lo, rect.y_hi);
+  }
+
+  if (is_deferred) shade_deferred(eye_figures, damage, light_source_loc);
+}
+
+void render_figures(Figure *figures[], const int figure_count, const Figure *focused_figure, Observer *observer, const Figure *light_source) {
+
+  draw_update_constants();
+
+  if (frame_arena == NULL) frame_arena = Arena_new(1 << 20);
+  Arena_reset(frame_arena);
 
   _Mat to_eyespace;
   calc_eyespace_matrix_M(to_eyespace, observer);
@@ -741,22 +1972,136 @@ void render_figures(Figure *figures[], const int figure_count, const Figure *foc
     // TODO: better solution
     light_source_loc = (v3) { -DBL_MAX, -DBL_MAX, -DBL_MAX };
   } else {
-    light_source_loc = Figure_center(light_source);
+    light_source_loc = v3_transform(Figure_center(light_source), to_eyespace);
   }
 
-  Zbuf zbuf;
-  zbuf_init(zbuf);
+  RenderSettings settings;
+  RenderSettings_capture(&settings, to_eyespace, light_source_loc);
+
+  // Heatmaps count the work of whole frames
+  int redraw_all =
+       !DO_DAMAGE_TRACKING
+    || heatmap_mode != heatmap_off
+    || !frame_valid
+    || figure_count != frame_record_count
+    || memcmp(&settings, &frame_settings, sizeof(RenderSettings)) != 0;
+
+  for (int figure_i = 0; !redraw_all && figure_i < figure_count; figure_i++) {
+    if (frame_records[figure_i].figure != figures[figure_i]) redraw_all = 1;
+  }
+
+  if (figure_count != frame_record_count) {
+    frame_records = realloc(frame_records, figure_count * sizeof(FrameRecord));
+    frame_record_count = figure_count;
+  }
+
+  // Find the damaged regions: wherever changed figures were or now are.
+  // A change of focus moves figures between the layer and the frame.
+
+  // Scenes may have too many figures for the stack
+  EyeFigure *eye_figures = Arena_alloc(frame_arena, figure_count * sizeof(EyeFigure));
+  ScreenRect layer_damage = redraw_all ? screen_rect() : empty_rect;
+  ScreenRect frame_damage = redraw_all ? screen_rect() : empty_rect;
+  int focused_i = -1;
 
   for (int figure_i = 0; figure_i < figure_count; figure_i++) {
     const Figure *figure = figures[figure_i];
+    EyeFigure *eye_figure = &eye_figures[figure_i];
+    FrameRecord *record = &frame_records[figure_i];
+    const int is_focused = figure == focused_figure;
+    if (is_focused) focused_i = figure_i;
+
+    eye_figure->figure = NULL;
+    if (   !redraw_all
+        && record->version == figure->version
+        && record->in_layer == !is_focused
+        && record->culled == figure->culled
+    ) continue;
+
+    // A culled figure keeps its place, but covers nothing
+    int has_rect = 1;
+    ScreenRect rect = empty_rect;
+    if (!figure->culled) {
+      EyeFigure_init(eye_figure, figure, figure_i, is_focused, to_eyespace);
+      has_rect = eye_figure->has_rect;
+      rect = eye_figure->rect;
+    }
+
+    if (!redraw_all) {
+      if (record->in_layer) layer_damage = damage_union(layer_damage, record->has_rect, record->rect);
+      if (!is_focused) layer_damage = damage_union(layer_damage, has_rect, rect);
+      frame_damage = damage_union(frame_damage, record->has_rect, record->rect);
+      frame_damage = damage_union(frame_damage, has_rect, rect);
+    }
+
+    record->figure = figure;
+    record->version = figure->version;
+    record->in_layer = !is_focused;
+    record->culled = figure->culled;
+    record->has_rect = has_rect;
+    record->rect = rect;
+  }
+
+  memcpy(&frame_settings, &settings, sizeof(RenderSettings));
+  frame_valid = 1;
+
+  frame_damage = ScreenRect_union(frame_damage, layer_damage);
+
+  // The focused figure's halo is found from every pixel it covers,
+  // so the figure is redrawn whole or not at all
+  const FrameRecord *focused_record = focused_i < 0 ? NULL : &frame_records[focused_i];
+  int draw_focused = 0;
+  if (focused_record != NULL && !ScreenRect_is_empty(frame_damage)) {
+    if (!focused_record->has_rect) {
+      frame_damage = screen_rect();
+      draw_focused = 1;
+    } else if (!ScreenRect_is_empty(ScreenRect_intersect(focused_record->rect, frame_damage))) {
+      frame_damage = ScreenRect_union(frame_damage, focused_record->rect);
+      draw_focused = 1;
+    }
+  }
+
+  layer_damage = ScreenRect_intersect(layer_damage, screen_rect());
+  frame_damage = ScreenRect_intersect(frame_damage, screen_rect());
+  redrawn_layer_pixel_count = ScreenRect_area(layer_damage);
+  redrawn_pixel_count = ScreenRect_area(frame_damage);
 
-    Figure clone;
-    memcpy(&clone, figure, sizeof(Figure));
+  occluded_figure_count  = 0;
+  occluded_polygon_count = 0;
+  if (heatmap_mode != heatmap_off) heatmap_begin_frame(figure_count);
 
-    Figure_transform(&clone, to_eyespace);
-    Figure_render(&clone, figure == focused_figure, light_source_loc, zbuf);
+  if (!ScreenRect_is_empty(layer_damage)) {
+    render_layer(eye_figures, figures, figure_count, layer_damage, redraw_all, to_eyespace, light_source_loc);
   }
 
+  if (!ScreenRect_is_empty(frame_damage)) {
+    buffers_copy(frame_zbuf, frame_color, layer_zbuf, layer_color, frame_damage);
+
+    if (draw_focused) {
+      EyeFigure *eye_figure = &eye_figures[focused_i];
+      if (eye_figure->figure == NULL) {
+        EyeFigure_init(eye_figure, figures[focused_i], focused_i, 1, to_eyespace);
+      }
+
+      draw_target_set(frame_zbuf, frame_color);
+      draw_clip = frame_damage;
+
+      if (heatmap_mode != heatmap_off) heatmap_begin_figure(focused_i);
+      Figure_render(eye_figure->figure, 1, light_source_loc, frame_zbuf);
+      if (heatmap_mode != heatmap_off) heatmap_end_figure();
+    }
+  }
+
+  draw_target_set(frame_zbuf, frame_color);
+  draw_clip_reset();
+
+  // The eye-space figures are in frame_arena and go when it's next reset
+
+  render_profile_merge();
+
+  frame_present();
+  if (heatmap_mode != heatmap_off) heatmap_render();
+
 }
 
 
@@ -0,0 +1,448 @@
+#ifndef scene_c_INCLUDED
+#define scene_c_INCLUDED
+
+// Scene files and the scene graph
+//
+// A scene file describes a tree of nodes. Each node has a transformation
+// relative to its parent, and may have a figure, which is placed by the
+// product of the transformations from the root down to the node. So
+// moving a node (focus its figure and move it as usual) moves everything
+// beneath it too. For example,
+//
+//   # A planet with a moon, far enough away to be seen
+//   node planet {
+//     translate 0 0 20
+//     figure xyz/sphere.xyz
+//     color .3 .5 1
+//     node moon {
+//       scale .3 .3 .3
+//       translate 2 0 0
+//       figure xyz/sphere.xyz
+//     }
+//   }
+//
+// Within a node, these may come in any order:
+//   figure <arg>             a path or built-in figure name, as on the command line,
+//                            centered on the node's origin
+//   color <r> <g> <b>        the color of a figure loaded from a path
+//   translate <x> <y> <z>    transformations, each applied after the ones before it
+//   scale <x> <y> <z>
+//   rotate <x|y|z> <degrees>
+//   node <name> { ... }      a child
+// and # starts a comment, which runs to the end of the line. Figures are
+// added to the world, and so numbered for focusing, in the order they come.
+//
+// Figures loaded from paths are instances of one mesh per path (see
+// mesh.c), so a model used by many nodes is only loaded once.
+//
+// Each node caches its matrix into world space and the world-space
+// bounding box of its subtree. When a node moves, only the matrices below
+// it and the bounds on the path up to the root are found again. The
+// bounds let whole subtrees out of view be left out of rendering at once.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#include "state.c"
+#include "matrix.c"
+#include "shapes/figure.c"
+#include "shapes/instances.c"
+#include "rendering/observer.c"
+#include "util/dyn.c"
+
+typedef struct SceneNode SceneNode;
+DYN_INIT(SceneNodeList, SceneNode*);
+
+struct SceneNode {
+  char name[32];
+  SceneNode *parent;
+  SceneNodeList *children;
+
+  // Parent's space to the node's space
+  _Mat local;
+  // The node's space to world space: the parent's world times local
+  _Mat world;
+  // What the figure has been transformed by so far, i.e. world as it was
+  _Mat placed;
+
+  // NULL if none. Belongs to the list of figures, not to the node
+  Figure *figure;
+
+  // World-space bounds of the figures of the node and its descendants
+  int has_bounds;
+  v3 lows;
+  v3 highs;
+
+  // Has local changed since world was last found?
+  int transform_dirty;
+  // Has anything in the subtree changed since the bounds were last found?
+  int subtree_dirty;
+};
+
+// A mesh loaded for the scene, by the path it was loaded from
+typedef struct {
+  char path[256];
+  Mesh *mesh;
+} SceneMesh;
+
+DYN_INIT(SceneMeshes, SceneMesh);
+
+typedef struct {
+  SceneNode *root;
+  // Every node, to find the one a figure belongs to
+  SceneNodeList *nodes;
+  // Each holds a reference to its mesh
+  SceneMeshes *meshes;
+} Scene;
+
+// Everything loaded from scene files, or NULL if none has been
+Scene *scene = NULL;
+
+// The color of a figure from a path, unless the scene says otherwise
+const v3 scene_default_rgb = { .8, .5, .8 };
+
+// Figures of the scene left out of the last render as being out of view
+int culled_figure_count = 0;
+
+
+// == The graph == //
+
+static SceneNode *SceneNode_new(Scene *scene, SceneNode *parent, const char *name) {
+  SceneNode *node = malloc(sizeof(SceneNode));
+
+  snprintf(node->name, sizeof(node->name), "%s", name);
+  node->parent = parent;
+  node->children = SceneNodeList_new(2);
+  node->figure = NULL;
+  node->has_bounds = 0;
+
+  const _Mat id = Mat_identity();
+  Mat_clone_M(node->local, id);
+  Mat_clone_M(node->world, id);
+  Mat_clone_M(node->placed, id);
+
+  node->transform_dirty = 1;
+  node->subtree_dirty = 1;
+
+  if (parent != NULL) SceneNodeList_append(parent->children, node);
+  SceneNodeList_append(scene->nodes, node);
+  return node;
+}
+
+Scene *Scene_new() {
+  Scene *scene = malloc(sizeof(Scene));
+  scene->nodes = SceneNodeList_new(16);
+  scene->meshes = SceneMeshes_new(4);
+  scene->root = SceneNode_new(scene, NULL, "root");
+  return scene;
+}
+
+void Scene_destroy(Scene *scene) {
+  /* Free the scene, but not its figures, which belong to the list they were added to */
+  for (int i = 0; i < scene->nodes->length; i++) {
+    SceneNode *node = SceneNodeList_get(scene->nodes, i);
+    Dyn_destroy(node->children);
+    free(node);
+  }
+  for (int i = 0; i < scene->meshes->length; i++) {
+    Mesh_release(SceneMeshes_get(scene->meshes, i).mesh);
+  }
+  Dyn_destroy(scene->nodes);
+  Dyn_destroy(scene->meshes);
+  free(scene);
+}
+
+static void SceneNode_mark_dirty(SceneNode *node) {
+  node->transform_dirty = 1;
+  for (SceneNode *ancestor = node; ancestor != NULL; ancestor = ancestor->parent) {
+    ancestor->subtree_dirty = 1;
+  }
+}
+
+static void SceneNode_update(SceneNode *node, const _Mat parent_world, const int parent_moved) {
+  /* Bring the subtree's world matrices, figures, and bounds up to date */
+  if (!parent_moved && !node->subtree_dirty) return;
+
+  const int moved = parent_moved || node->transform_dirty;
+  if (moved) {
+    Mat_mult_M(node->world, parent_world, node->local);
+
+    if (node->figure != NULL) {
+      // Figures are transformed in place, so undo the old placement in the same go
+      _Mat unplace, delta;
+      Mat_inv_M(unplace, node->placed);
+      Mat_mult_M(delta, node->world, unplace);
+      Figure_transform(node->figure, delta);
+      Mat_clone_M(node->placed, node->world);
+    }
+  }
+
+  node->has_bounds = 0;
+  if (node->figure != NULL) {
+    Figure_bounds_M(&node->lows, &node->highs, node->figure);
+    node->has_bounds = 1;
+  }
+
+  for (int i = 0; i < node->children->length; i++) {
+    SceneNode *child = SceneNodeList_get(node->children, i);
+    SceneNode_update(child, node->world, moved);
+    if (!child->has_bounds) continue;
+
+    if (!node->has_bounds) {
+      node->lows = child->lows;
+      node->highs = child->highs;
+      node->has_bounds = 1;
+      continue;
+    }
+
+    for (int axis = 0; axis < 3; axis++) {
+      if (child->lows [axis] < node->lows [axis]) node->lows [axis] = child->lows [axis];
+      if (child->highs[axis] > node->highs[axis]) node->highs[axis] = child->highs[axis];
+    }
+  }
+
+  node->transform_dirty = 0;
+  node->subtree_dirty = 0;
+}
+
+void Scene_update(Scene *scene) {
+  const _Mat id = Mat_identity();
+  SceneNode_update(scene->root, id, 0);
+}
+
+SceneNode *Scene_find(const Scene *scene, const Figure *figure) {
+  /* Find the node of a figure, or NULL if it isn't in the scene */
+  for (int i = 0; i < scene->nodes->length; i++) {
+    SceneNode *node = SceneNodeList_get(scene->nodes, i);
+    if (node->figure == figure) return node;
+  }
+  return NULL;
+}
+
+int Scene_transform_figure(Scene *scene, const Figure *figure, const _Mat transformation) {
+  /* Apply a world-space transformation to a figure's node, and so to its descendants.
+     Returns 0 if the figure isn't in the scene, which is then unchanged */
+  if (scene == NULL) return 0;
+
+  SceneNode *node = Scene_find(scene, figure);
+  if (node == NULL) return 0;
+
+  // Moving the node's space by T in the world means
+  //   parent_world * local'  =  T * parent_world * local
+  _Mat parent_world, unparent;
+  Mat_clone_M(parent_world, node->parent->world);
+  Mat_inv_M(unparent, parent_world);
+
+  _Mat moved;
+  Mat_mult_M(moved, transformation, node->world);
+  Mat_mult_M(node->local, unparent, moved);
+
+  SceneNode_mark_dirty(node);
+  Scene_update(scene);
+  return 1;
+}
+
+
+// == Culling == //
+
+static int box_out_of_view(const v3 lows, const v3 highs, const _Mat to_eyespace) {
+  /* Is a world-space box entirely beyond one of the planes bounding the view? */
+  const float H = tan(HALF_ANGLE);
+
+  int near = 0, far = 0, left = 0, right = 0, below = 0, above = 0;
+  for (int corner_idx = 0; corner_idx < 8; corner_idx++) {
+    const v3 corner = {
+      (corner_idx & 1) ? highs[0] : lows[0],
+      (corner_idx & 2) ? highs[1] : lows[1],
+      (corner_idx & 4) ? highs[2] : lows[2]
+    };
+    const v3 p = v3_transform(corner, to_eyespace);
+
+    if (p[2] < HITHER) near++;
+    if (p[2] > YON) far++;
+    if (p[0] < -H * p[2]) left++;
+    if (p[0] > +H * p[2]) right++;
+    if (p[1] < -H * p[2]) below++;
+    if (p[1] > +H * p[2]) above++;
+  }
+
+  return near == 8 || far == 8 || left == 8 || right == 8 || below == 8 || above == 8;
+}
+
+static void SceneNode_cull(SceneNode *node, const _Mat to_eyespace, int in_view) {
+  /* Mark the figures of the subtree as culled or not. Once a subtree
+     is out of view, so is everything in it, without further tests */
+  if (in_view && node->has_bounds) in_view = !box_out_of_view(node->lows, node->highs, to_eyespace);
+
+  if (node->figure != NULL) {
+    node->figure->culled = !in_view;
+    if (!in_view) culled_figure_count++;
+  }
+
+  for (int i = 0; i < node->children->length; i++) {
+    SceneNode_cull(SceneNodeList_get(node->children, i), to_eyespace, in_view);
+  }
+}
+
+void Scene_cull(Scene *scene, Observer *observer) {
+  /* Mark the scene's figures which are out of the observer's view */
+  culled_figure_count = 0;
+
+  // Without clipping, figures beyond the view may still be drawn
+  if (!DO_CLIPPING) {
+    for (int i = 0; i < scene->nodes->length; i++) {
+      SceneNode *node = SceneNodeList_get(scene->nodes, i);
+      if (node->figure != NULL) node->figure->culled = 0;
+    }
+    return;
+  }
+
+  _Mat to_eyespace;
+  calc_eyespace_matrix_M(to_eyespace, observer);
+  SceneNode_cull(scene->root, to_eyespace, 1);
+}
+
+
+// == Loading == //
+
+static Mesh *Scene_mesh(Scene *scene, const char *path) {
+  /* The mesh loaded from a path, loading it if it hasn't been yet */
+  for (int i = 0; i < scene->meshes->length; i++) {
+    const SceneMesh entry = SceneMeshes_get(scene->meshes, i);
+    if (strcmp(entry.path, path) == 0) return entry.mesh;
+  }
+
+  SceneMesh entry;
+  snprintf(entry.path, sizeof(entry.path), "%s", path);
+  entry.mesh = Mesh_new(load_polyhedron(path));
+  entry.mesh->reference_count++;
+  SceneMeshes_append(scene->meshes, entry);
+  return entry.mesh;
+}
+
+static void scene_syntax_error(const char *path, const char *message, const char *word) {
+  printf("Error in scene %s: %s '%s'\n", path, message, word);
+  exit(1);
+}
+
+static float scene_read_float(FILE *file, const char *path) {
+  float value;
+  if (fscanf(file, "%f", &value) != 1) scene_syntax_error(path, "expected a number", "");
+  return value;
+}
+
+static int scene_read_word(char *word, FILE *file) {
+  /* Read the next word, skipping comments. Returns 0 at the end of the file */
+  while (fscanf(file, "%63s", word) == 1) {
+    if (word[0] != '#') return 1;
+    fscanf(file, "%*[^\n]");
+  }
+  return 0;
+}
+
+static void SceneNode_set_figure(Scene *scene, SceneNode *node, const char *figure_arg, const v3 color, const char *path) {
+  Figure *figure;
+  if (strchr(figure_arg, '/') != NULL) {
+    figure = Figure_from_MeshInstance(MeshInstance_new(Scene_mesh(scene, figure_arg), color));
+  } else {
+    figure = figure_instance_lookup(figure_arg);
+    if (figure == NULL) scene_syntax_error(path, "unknown figure", figure_arg);
+  }
+
+  // The figure is in the node's space, about its origin
+  Figure_move_to(figure, (v3) { 0, 0, 0 });
+  node->figure = figure;
+}
+
+static void Scene_read_node(Scene *scene, SceneNode *parent, FILE *file, const char *path, FigureList *list) {
+  /* Read a node, from just after the word "node", and its children */
+  char name[64];
+  char word[64];
+  if (!scene_read_word(name, file)) scene_syntax_error(path, "expected a node name", "");
+  if (!scene_read_word(word, file) || strcmp(word, "{") != 0) scene_syntax_error(path, "expected '{' after node", name);
+
+  SceneNode *node = SceneNode_new(scene, parent, name);
+
+  v3 color = scene_default_rgb;
+
+  while (1) {
+    if (!scene_read_word(word, file)) scene_syntax_error(path, "missing '}' for node", name);
+    if (strcmp(word, "}") == 0) break;
+
+    if (strcmp(word, "node") == 0) {
+      Scene_read_node(scene, node, file, path, list);
+    } else if (strcmp(word, "figure") == 0) {
+      char figure_arg[256];
+      if (fscanf(file, "%255s", figure_arg) != 1) scene_syntax_error(path, "expected a figure for node", name);
+      if (node->figure != NULL) scene_syntax_error(path, "more than one figure for node", name);
+      SceneNode_set_figure(scene, node, figure_arg, color, path);
+      FigureList_append(list, node->figure);
+    } else if (strcmp(word, "color") == 0) {
+      for (int i = 0; i < 3; i++) color[i] = scene_read_float(file, path);
+      if (node->figure != NULL && node->figure->kind == fk_MeshInstance) node->figure->impl.mesh_instance->color = color;
+    } else if (strcmp(word, "translate") == 0) {
+      const float x = scene_read_float(file, path);
+      const float y = scene_read_float(file, path);
+      const float z = scene_read_float(file, path);
+      const _Mat m = Mat_translate(x, y, z);
+      Mat_then_M(node->local, m);
+    } else if (strcmp(word, "scale") == 0) {
+      const float x = scene_read_float(file, path);
+      const float y = scene_read_float(file, path);
+      const float z = scene_read_float(file, path);
+      const _Mat m = Mat_dilate(x, y, z);
+      Mat_then_M(node->local, m);
+    } else if (strcmp(word, "rotate") == 0) {
+      char axis[64];
+      if (!scene_read_word(axis, file)) scene_syntax_error(path, "expected an axis", "");
+      const float angle = DEGREES(scene_read_float(file, path));
+      if (strcmp(axis, "x") == 0) {
+        const _Mat m = Mat_x_rot(angle);
+        Mat_then_M(node->local, m);
+      } else if (strcmp(axis, "y") == 0) {
+        const _Mat m = Mat_y_rot(angle);
+        Mat_then_M(node->local, m);
+      } else if (strcmp(axis, "z") == 0) {
+        const _Mat m = Mat_z_rot(angle);
+        Mat_then_M(node->local, m);
+      } else {
+        scene_syntax_error(path, "unknown axis", axis);
+      }
+    } else {
+      scene_syntax_error(path, "unknown word", word);
+    }
+  }
+}
+
+int is_scene_path(const char *arg) {
+  const size_t length = strlen(arg);
+  return length > 6 && strcmp(arg + length - 6, ".scene") == 0;
+}
+
+int scene_load(FigureList *list, const char *path) {
+  /* Add the nodes of a scene file to the scene, and append their figures to list.
+     Returns the number of figures */
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    printf("Cannot open scene %s\n", path);
+    exit(1);
+  }
+
+  if (scene == NULL) scene = Scene_new();
+  const int first_figure = list->length;
+
+  char word[64];
+  while (scene_read_word(word, file)) {
+    if (strcmp(word, "node") != 0) scene_syntax_error(path, "expected 'node', not", word);
+    Scene_read_node(scene, scene->root, file, path, list);
+  }
+
+  fclose(file);
+  Scene_update(scene);
+  return list->length - first_figure;
+}
+
+
+#endif // scene_c_INCLUDED
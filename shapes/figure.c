@@ -4,25 +4,52 @@
 #include "lattice.c"
 #include "polyhedron.c"
 #include "intersector.c"
+#include "sdf.c"
+#include "mesh.c"
 #include "observer_figure.c"
 
 typedef enum {
   fk_Polyhedron,
   fk_Lattice,
   fk_Intersector,
+  fk_Sdf,
+  fk_MeshInstance,
   fk_Observer
 } FigureKind;
 
 typedef struct {
   FigureKind kind;
+  // Changes whenever the figure does; no two figures ever share a version
+  unsigned long version;
+  // Arena holding the figure's geometry, released with the figure; NULL if none
+  Arena *pool;
+  // Left out of rendering, being out of view (see Scene_cull in scene.c)
+  int culled;
   struct {
     Polyhedron  *polyhedron;
     Lattice       *lattice;
     Intersector *intersector;
+    Sdf         *sdf;
+    MeshInstance *mesh_instance;
     Observer    *observer;
   } impl;
 } Figure;
 
+unsigned long figure_version_counter = 0;
+
+unsigned long Figure_next_version() {
+  return ++figure_version_counter;
+}
+
+static Figure *Figure_alloc(const FigureKind kind, Arena *arena) {
+  Figure *figure = Arena_alloc(arena, sizeof(Figure));
+  figure->kind = kind;
+  figure->version = Figure_next_version();
+  figure->pool = NULL;
+  figure->culled = 0;
+  return figure;
+}
+
 Figure *Figure_from_Polyhedron(Polyhedron *polyhedron) {
 #ifdef DEBUG
   if (polyhedron == NULL) {
@@ -31,9 +58,10 @@ Figure *Figure_from_Polyhedron(Polyhedron *polyhedron) {
   }
 #endif
 
-  Figure *figure = malloc(sizeof(Figure));
-  figure->kind = fk_Polyhedron;
+  Figure *figure = Figure_alloc(fk_Polyhedron, NULL);
   figure->impl.polyhedron = polyhedron;
+  // Geometry built in its own pool (see load_polyhedron) now belongs to the figure
+  figure->pool = polyhedron->arena;
   return figure;
 }
 
@@ -45,8 +73,7 @@ Figure *Figure_from_Lattice(Lattice *lattice) {
   }
 #endif
 
-  Figure *figure = malloc(sizeof(Figure));
-  figure->kind = fk_Lattice;
+  Figure *figure = Figure_alloc(fk_Lattice, NULL);
   figure->impl.lattice = lattice;
   return figure;
 }
@@ -59,12 +86,37 @@ Figure *Figure_from_Intersector(Intersector *intersector) {
   }
 #endif
 
-  Figure *figure = malloc(sizeof(Figure));
-  figure->kind = fk_Intersector;
+  Figure *figure = Figure_alloc(fk_Intersector, NULL);
   figure->impl.intersector = intersector;
   return figure;
 }
 
+Figure *Figure_from_Sdf(Sdf *sdf) {
+#ifdef DEBUG
+  if (sdf == NULL) {
+    printf("will not wrap null sdf\n");
+    exit(1);
+  }
+#endif
+
+  Figure *figure = Figure_alloc(fk_Sdf, NULL);
+  figure->impl.sdf = sdf;
+  return figure;
+}
+
+Figure *Figure_from_MeshInstance(MeshInstance *mesh_instance) {
+#ifdef DEBUG
+  if (mesh_instance == NULL) {
+    printf("will not wrap null mesh instance\n");
+    exit(1);
+  }
+#endif
+
+  Figure *figure = Figure_alloc(fk_MeshInstance, NULL);
+  figure->impl.mesh_instance = mesh_instance;
+  return figure;
+}
+
 Figure *Figure_from_Observer(Observer *observer) {
 #ifdef DEBUG
   if (observer == NULL) {
@@ -73,8 +125,7 @@ Figure *Figure_from_Observer(Observer *observer) {
   }
 #endif
 
-  Figure *figure = malloc(sizeof(Figure));
-  figure->kind = fk_Observer;
+  Figure *figure = Figure_alloc(fk_Observer, NULL);
   figure->impl.observer = observer;
   return figure;
 }
@@ -83,10 +134,13 @@ Figure *Figure_from_Observer(Observer *observer) {
 // == Lifted functions == //
 
 void Figure_transform(Figure *figure, const _Mat transformation) {
+  figure->version = Figure_next_version();
   switch (figure->kind) {
     case fk_Polyhedron: return Polyhedron_transform(figure->impl.polyhedron, transformation);
     case fk_Lattice: return Lattice_transform(figure->impl.lattice, transformation);
     case fk_Intersector: return Intersector_transform(figure->impl.intersector, transformation);
+    case fk_Sdf: return Sdf_transform(figure->impl.sdf, transformation);
+    case fk_MeshInstance: return MeshInstance_transform(figure->impl.mesh_instance, transformation);
     case fk_Observer: return Observer_transform(figure->impl.observer, transformation);
   }
 }
@@ -96,17 +150,43 @@ void Figure_bounds_M(v3 *lows, v3 *highs, const Figure *figure) {
     case fk_Polyhedron :return Polyhedron_bounds_M(lows, highs, figure->impl.polyhedron);
     case fk_Lattice: return Lattice_bounds_M(lows, highs, figure->impl.lattice);
     case fk_Intersector: return Intersector_bounds_M(lows, highs, figure->impl.intersector);
+    case fk_Sdf: return Sdf_bounds_M(lows, highs, figure->impl.sdf);
+    case fk_MeshInstance: return MeshInstance_bounds_M(lows, highs, figure->impl.mesh_instance);
     case fk_Observer: return Observer_bounds_M(lows, highs, figure->impl.observer);
   }
 }
 
+Figure *Figure_clone_in(const Figure *figure, Arena *arena) {
+  /* Clone a figure into an arena, or onto the heap if it is NULL.
+     A clone in an arena must not be passed to Figure_destroy. */
+  Figure *clone = Figure_alloc(figure->kind, arena);
+  switch (figure->kind) {
+    case fk_Polyhedron: clone->impl.polyhedron = Polyhedron_deep_clone_in(figure->impl.polyhedron, arena); break;
+    case fk_Lattice: clone->impl.lattice = Lattice_clone_in(figure->impl.lattice, arena); break;
+    case fk_Intersector: clone->impl.intersector = Intersector_clone_in(figure->impl.intersector, arena); break;
+    case fk_Sdf: clone->impl.sdf = Sdf_clone_in(figure->impl.sdf, arena); break;
+    case fk_MeshInstance: clone->impl.mesh_instance = MeshInstance_clone_in(figure->impl.mesh_instance, arena); break;
+    case fk_Observer: clone->impl.observer = Observer_clone_in(figure->impl.observer, arena); break;
+  }
+  return clone;
+}
+
+Figure *Figure_clone(const Figure *figure) {
+  return Figure_clone_in(figure, NULL);
+}
+
 void Figure_destroy(Figure *figure) {
   switch (figure->kind) {
-    case fk_Polyhedron: return Polyhedron_destroy(figure->impl.polyhedron);
-    case fk_Lattice: return Lattice_destroy(figure->impl.lattice);
-    case fk_Intersector: return Intersector_destroy(figure->impl.intersector);
-    case fk_Observer: return Observer_destroy(figure->impl.observer);
+    case fk_Polyhedron: Polyhedron_destroy(figure->impl.polyhedron); break;
+    case fk_Lattice: Lattice_destroy(figure->impl.lattice); break;
+    case fk_Intersector: Intersector_destroy(figure->impl.intersector); break;
+    case fk_Sdf: Sdf_destroy(figure->impl.sdf); break;
+    case fk_MeshInstance: MeshInstance_destroy(figure->impl.mesh_instance); break;
+    case fk_Observer: Observer_destroy(figure->impl.observer); break;
   }
+  // A pooled polyhedron is freed here, as one block
+  if (figure->pool != NULL) Arena_destroy(figure->pool);
+  free(figure);
 }
 
 
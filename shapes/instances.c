@@ -59,53 +59,41 @@ Figure *polyhedral_sphere_2() {
 }
 
 
-int return_closest(v3 *result, const Line *line, const float t1, const float t2) {
-
-  if (isnan(t1) && isnan(t2)) {
-    return 0;
-  }
-
-  const v3 s = line->p0;
-  const v3 d = Line_vector(line);
-
-  const v3 p1 = s + t1 * d;
-  const v3 p2 = s + t2 * d;
-
-  if (isnan(t1) && !isnan(t2)) {
-    *result = p1;
-    return 1;
-  }
-
-  if (isnan(t2) && !isnan(t1)) {
-    *result = p2;
+int first_entry(v3 *result, Line *line, void (*intervals)(IntervalList *result, Line *line)) {
+  /* Find where a line first enters a solid, in front of line->p0 */
+  IntervalList list;
+  intervals(&list, line);
+
+  for (int i = 0; i < list.length; i++) {
+    const float t = list.items[i].t_enter;
+    if (t < 0) continue;
+    *result = line->p0 + t * Line_vector(line);
     return 1;
   }
-
-  if (p1[2] < p2[2]) {
-    *result = p1;
-    return 1;
-  } else {
-    *result = p2;
-    return 1;
-  }
-
+  return 0;
 }
 
 
 // == Interector sphere == //
 
-int sphere_intersect(v3 *result, Line *line) {
+void sphere_intervals(IntervalList *result, Line *line) {
   const v3 d = Line_vector(line);
   const v3 s = line->p0;
 
-  const float A = pow(d[0], 2) + pow(d[1], 2) + pow(d[2], 2);
-  const float B = 2 * (s[0] * d[0] + s[1] * d[1] + s[2] * d[2]);
-  const float C = pow(s[0], 2) + pow(s[1], 2) + pow(s[2], 2) - 1;
+  const float A = v3_dot(d, d);
+  const float B = 2 * v3_dot(s, d);
+  const float C = v3_dot(s, s) - 1;
 
-  const float t1 = (-B + sqrt(pow(B, 2) - 4 * A * C)) / (2 * A);
-  const float t2 = (-B - sqrt(pow(B, 2) - 4 * A * C)) / (2 * A);
+  result->length = 0;
+  const float discriminant = B * B - 4 * A * C;
+  if (discriminant < 0) return;
 
-  return return_closest(result, line, t1, t2);
+  const float root = sqrt(discriminant);
+  IntervalList_append(result, (-B - root) / (2 * A), (-B + root) / (2 * A));
+}
+
+int sphere_intersect(v3 *result, Line *line) {
+  return first_entry(result, line, &sphere_intervals);
 }
 
 Figure *intersector_sphere() {
@@ -125,41 +113,43 @@ Figure *intersector_sphere() {
 const float cyl_height = 4;
 const float cyl_radius = 1;
 
-int cylinder_intersect(v3 *result, Line *line) {
-
+void cylinder_intervals(IntervalList *result, Line *line) {
   const v3 s = line->p0;
   const v3 d = Line_vector(line);
+  result->length = 0;
 
+  // Within the infinite cylinder around the x axis
+  float t_enter = -INFINITY, t_exit = +INFINITY;
   const float r2 = cyl_radius * cyl_radius;
-  const float A = ( pow(d[1], 2) + pow(d[2], 2) ) / r2;
-  const float B = 2 * (s[1] * d[1] + s[2] * d[2]) / r2;
-  const float C = ( pow(s[1], 2) + pow(s[2], 2) ) / r2 - 1;
-
-  const float t1 = (-B + sqrt(pow(B, 2) - 4 * A * C)) / (2 * A);
-  const float t2 = (-B - sqrt(pow(B, 2) - 4 * A * C)) / (2 * A);
-
-  // so far we've been working with the cylinder as if it's infinite
-  // clip off the ends
-  const float t_bound_lo = (-cyl_height / 2 - s[0]) / d[0];
-  const float t_bound_hi = (+cyl_height / 2 - s[0]) / d[0];
-  const v3 p1 = s + t1 * d;
-  const v3 p2 = s + t2 * d;
-  const int t1_in_bounds = -cyl_height / 2 <= p1[0] && p1[0] <= +cyl_height / 2;
-  const int t2_in_bounds = -cyl_height / 2 <= p2[0] && p2[0] <= +cyl_height / 2;
-
-  // TODO: make return_closest varargs and replace the 2nd and 3d cases with it
-  if (t1_in_bounds && t2_in_bounds) {
-    return return_closest(result, line, t1, t2);
-  } else if (t1_in_bounds) {
-    *result = line->p0 + t1 * Line_vector(line);
-    return 1;
-  } else if (t2_in_bounds) {
-    *result = line->p0 + t2 * Line_vector(line);
-    return 1;
+  const float A = d[1] * d[1] + d[2] * d[2];
+  const float B = 2 * (s[1] * d[1] + s[2] * d[2]);
+  const float C = s[1] * s[1] + s[2] * s[2] - r2;
+  if (A == 0) {
+    if (C > 0) return;
   } else {
-    return 0;
+    const float discriminant = B * B - 4 * A * C;
+    if (discriminant < 0) return;
+    const float root = sqrt(discriminant);
+    t_enter = (-B - root) / (2 * A);
+    t_exit  = (-B + root) / (2 * A);
+  }
+
+  // and between the caps
+  if (d[0] == 0) {
+    if (fabs(s[0]) > cyl_height / 2) return;
+  } else {
+    float t_lo = (-cyl_height / 2 - s[0]) / d[0];
+    float t_hi = (+cyl_height / 2 - s[0]) / d[0];
+    if (t_lo > t_hi) { const float t = t_lo; t_lo = t_hi; t_hi = t; }
+    t_enter = fmax(t_enter, t_lo);
+    t_exit  = fmin(t_exit , t_hi);
   }
 
+  IntervalList_append(result, t_enter, t_exit);
+}
+
+int cylinder_intersect(v3 *result, Line *line) {
+  return first_entry(result, line, &cylinder_intervals);
 }
 
 Figure *intersector_cylinder() {
@@ -174,6 +164,39 @@ Figure *intersector_cylinder() {
 }
 
 
+// == CSG of intersectors: a cylinder with bites taken out == //
+
+Intersector *solid_sphere(const v3 center, const float radius) {
+  Intersector *sphere = Intersector_new_solid(&sphere_intervals, (v3) { -1, -1, -1 }, (v3) { 1, 1, 1 });
+
+  _Mat placement;
+  const _Mat translation = Mat_translate_v(center);
+  const _Mat dilation = Mat_dilate(radius, radius, radius);
+  Mat_mult_M(placement, translation, dilation);
+  Intersector_transform(sphere, placement);
+
+  return sphere;
+}
+
+Figure *intersector_csg() {
+  /* A cylinder, minus a sphere from its middle and bites out of its ends */
+  Intersector *cyl = Intersector_new_solid(
+    &cylinder_intervals,
+    (v3) { -cyl_height / 2, -cyl_radius, -cyl_radius },
+    (v3) { +cyl_height / 2, +cyl_radius, +cyl_radius }
+  );
+
+  Intersector *bites = Intersector_csg(csg_Union,
+    solid_sphere((v3) { -cyl_height / 2, 0, -cyl_radius }, 0.8),
+    solid_sphere((v3) { +cyl_height / 2, +cyl_radius, 0 }, 0.8)
+  );
+  Intersector *hollow = Intersector_csg(csg_Union, solid_sphere((v3) { 0, 0, 0 }, 1.3), bites);
+
+  Figure *figure = Figure_from_Intersector(Intersector_csg(csg_Difference, cyl, hollow));
+  nicely_place_figure(figure);
+  return figure;
+}
+
 // == Vase thing == //
 
 v3 vase_parameterization(float t, float s) {
@@ -250,6 +273,31 @@ Figure *mandelbrot() {
 }
 
 
+// == SDF blob == //
+
+Figure *sdf_blob() {
+  /* Spheres melted into a ring, with a flat bottom */
+  Sdf *sdf = Sdf_new((v3) { -2, -1, -2 }, (v3) { 2, 1.5, 2 });
+
+  const int ring = Sdf_torus(sdf, (v3) { 0, 0, 0 }, 1.3, 0.4);
+  const int left = Sdf_sphere(sdf, (v3) { -1.1, 0.3, 0 }, 0.7);
+  const int right = Sdf_sphere(sdf, (v3) { 1.1, 0.3, 0 }, 0.7);
+  const int top = Sdf_sphere(sdf, (v3) { 0, 0.7, 0 }, 0.6);
+
+  int blob = Sdf_smooth_union(sdf, ring, left, 0.5);
+  blob = Sdf_smooth_union(sdf, blob, right, 0.5);
+  blob = Sdf_smooth_union(sdf, blob, top, 0.8);
+
+  // Cut off below y = -0.25
+  const int above = Sdf_box(sdf, (v3) { 0, 0.625, 0 }, (v3) { 2, 0.875, 2 });
+  Sdf_intersection(sdf, blob, above);
+
+  Figure *figure = Figure_from_Sdf(sdf);
+  nicely_place_figure(figure);
+  return figure;
+}
+
+
 // == Lookup table == //
 
 Figure *figure_instance_lookup(const char *key) {
@@ -257,10 +305,233 @@ Figure *figure_instance_lookup(const char *key) {
   else if (strcmp(key, "polysphere_2") == 0) return polyhedral_sphere_2();
   else if (strcmp(key, "isphere"     ) == 0) return intersector_sphere();
   else if (strcmp(key, "icyl"        ) == 0) return intersector_cylinder();
+  else if (strcmp(key, "icsg"        ) == 0) return intersector_csg();
   else if (strcmp(key, "vase"        ) == 0) return vase();
   else if (strcmp(key, "mandelbrot"  ) == 0) return mandelbrot();
+  else if (strcmp(key, "sdfblob"     ) == 0) return sdf_blob();
   return NULL;
 }
 
+Figure *figure_from_arg(const char *arg) {
+  /* Make the figure named by a command-line argument, or return NULL if there is none */
+
+  const int is_path = strchr(arg, '/') != NULL;
+
+  if (is_path) {
+    // load a polyhedron from a filname
+    const char *filename = arg;
+    Polyhedron *polyhedron = load_polyhedron(filename);
+    Figure *figure = Figure_from_Polyhedron(polyhedron);
+    nicely_place_figure(figure);
+    return figure;
+  } else {
+    // get a premade figure
+    const char *key = arg;
+    return figure_instance_lookup(key);
+  }
+}
+
+
+// == Instanced grids == //
+
+// Distance between neighbouring instances of a grid, relative to the mesh's largest side
+const float grid_spacing = 1.5;
+
+int grid_from_mesh(FigureList *list, Mesh *mesh, const int counts[3]) {
+  /* Append instances of a mesh arranged in a grid, placed as nicely_place_figure would
+     place the whole grid. Each is colored by where it is in the grid */
+
+  const v3 size = mesh->max_corner - mesh->min_corner;
+  const v3 mesh_center = (mesh->min_corner + mesh->max_corner) / 2;
+  const float step = grid_spacing * fmax(size[0], fmax(size[1], size[2]));
+
+  const float desired_z = 15;
+  const float width = (counts[2] - 1) * step + size[2];
+  const v3 grid_center = { 0, 0, width + desired_z };
+
+  int count = 0;
+  for (int i = 0; i < counts[0]; i++) {
+    for (int j = 0; j < counts[1]; j++) {
+      for (int k = 0; k < counts[2]; k++) {
+        const v3 cell = { i, j, k };
+        v3 fraction = { .5, .5, .5 };
+        for (int axis = 0; axis < 3; axis++) {
+          if (counts[axis] > 1) fraction[axis] = cell[axis] / (counts[axis] - 1);
+        }
+
+        const v3 color = { .4 + .5 * fraction[0], .4 + .5 * fraction[1], .4 + .5 * fraction[2] };
+        MeshInstance *instance = MeshInstance_new(mesh, color);
+
+        const v3 offset = step * (cell - (v3) { counts[0] - 1, counts[1] - 1, counts[2] - 1 } / 2);
+        const _Mat placement = Mat_translate_v(grid_center + offset - mesh_center);
+        MeshInstance_transform(instance, placement);
+
+        FigureList_append(list, Figure_from_MeshInstance(instance));
+        count++;
+      }
+    }
+  }
+
+  return count;
+}
+
+// == Stress scenes == //
+
+// Generated scenes for measuring how rendering scales. For instance,
+//   stress@figures=1000,polygons=1000,depth=4,coverage=.5,seed=7
+// makes 1000 spheres of about 1000 polygons each, all instances of one
+// mesh, scattered at random over half of the screen and sized so that
+// each pixel of that half is covered by about 4 of them on average.
+// Settings may be left out, and the same settings always make the same scene.
+
+typedef struct {
+  int figures;
+  // Polygons in each figure
+  int polygons;
+  // Figures over each pixel of the covered region, on average
+  float depth;
+  // Fraction of the screen which the figures are scattered over
+  float coverage;
+  unsigned long long seed;
+} StressSettings;
+
+const StressSettings stress_defaults = { 100, 200, 2, .5, 1 };
+
+// Figures are scattered between these depths
+const float stress_near_z = 10;
+const float stress_far_z = 28;
+
+float stress_random(unsigned long long *state) {
+  /* Uniform in [0, 1), by xorshift, so that scenes don't depend on the C library */
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return (*state >> 40) / (float) (1 << 24);
+}
+
+int stress_settings_parse(StressSettings *settings, const char *options) {
+  /* Read settings like "figures=10,depth=3" over the defaults. Returns 0 if they're invalid */
+  *settings = stress_defaults;
+
+  const char *option = options;
+  while (option != NULL && *option != '\0') {
+    char key[16];
+    double value;
+    if (sscanf(option, "%15[a-z]=%lf", key, &value) != 2) return 0;
+
+         if (strcmp(key, "figures" ) == 0) settings->figures = value;
+    else if (strcmp(key, "polygons") == 0) settings->polygons = value;
+    else if (strcmp(key, "depth"   ) == 0) settings->depth = value;
+    else if (strcmp(key, "coverage") == 0) settings->coverage = value;
+    else if (strcmp(key, "seed"    ) == 0) settings->seed = value;
+    else return 0;
+
+    option = strchr(option, ',');
+    if (option != NULL) option++;
+  }
+
+  return settings->figures >= 1
+      && settings->polygons >= 1
+      && settings->depth > 0
+      && settings->coverage > 0 && settings->coverage <= 1;
+}
+
+Mesh *stress_sphere_mesh(const int polygons) {
+  /* A closed unit sphere of about the given number of quads, twice as many around as up */
+  const int rows = fmax(2, round(sqrt(polygons / 2.0)));
+
+  // Sample latitudes from pole to pole inclusive; the last is at s0 + s_count * ds
+  const int s_count = rows + 1;
+  const float ds = M_PI / rows;
+
+  return Mesh_new(Polyhedron_from_parametric(
+    sphere_parameterization_1,
+    0, 2 * M_PI, 2 * rows, 1,
+    0, s_count * ds, s_count, 0
+  ));
+}
+
+int stress_scene(FigureList *list, const StressSettings *settings) {
+  /* Append the figures of a stress scene, returning how many there are */
+  Mesh *mesh = stress_sphere_mesh(settings->polygons);
+
+  unsigned long long state = (settings->seed + 1) * 0x9E3779B97F4A7C15ull;
+
+  // Over the screen, which spans [-H z, H z] at depth z, a sphere of radius r covers
+  // a fraction pi (r / H z)^2 / 4 of it. Averaged over uniform depths in [a, b] that's
+  // pi r^2 / (4 H^2 a b), and all of them are to cover the region depth times over.
+  const float H = tan(HALF_ANGLE);
+  const float a = stress_near_z;
+  const float b = stress_far_z;
+  float radius = H * sqrt(4 * settings->coverage * settings->depth * a * b / (settings->figures * M_PI));
+  // Keep the nearest ones in front of the observer
+  if (radius > a / 2) radius = a / 2;
+
+  const float spread = sqrt(settings->coverage);
+
+  for (int figure_i = 0; figure_i < settings->figures; figure_i++) {
+    const float z = a + (b - a) * stress_random(&state);
+    const float x = (2 * stress_random(&state) - 1) * spread * H * z;
+    const float y = (2 * stress_random(&state) - 1) * spread * H * z;
+
+    v3 color;
+    for (int i = 0; i < 3; i++) color[i] = .4 + .5 * stress_random(&state);
+
+    MeshInstance *instance = MeshInstance_new(mesh, color);
+
+    _Mat placement;
+    const _Mat dilation = Mat_dilate(radius, radius, radius);
+    const _Mat translation = Mat_translate(x, y, z);
+    Mat_mult_M(placement, translation, dilation);
+    MeshInstance_transform(instance, placement);
+
+    FigureList_append(list, Figure_from_MeshInstance(instance));
+  }
+
+  return settings->figures;
+}
+
+int figures_from_arg(FigureList *list, const char *arg) {
+  /* Append the figures named by a command-line argument, returning how many there were.
+     A path or the name of a polyhedron may be followed by e.g. @grid=10x10x5 for a grid of
+     instances of the one mesh, and "stress" makes a stress scene (see above) */
+
+  if (strncmp(arg, "stress", 6) == 0 && (arg[6] == '\0' || arg[6] == '@')) {
+    StressSettings settings;
+    if (!stress_settings_parse(&settings, arg[6] == '@' ? arg + 7 : NULL)) return 0;
+    return stress_scene(list, &settings);
+  }
+
+  const char *at = strchr(arg, '@');
+  if (at == NULL) {
+    Figure *figure = figure_from_arg(arg);
+    if (figure == NULL) return 0;
+    FigureList_append(list, figure);
+    return 1;
+  }
+
+  int counts[3];
+  if (sscanf(at, "@grid=%dx%dx%d", &counts[0], &counts[1], &counts[2]) != 3) return 0;
+  if (counts[0] < 1 || counts[1] < 1 || counts[2] < 1) return 0;
+
+  const size_t name_length = at - arg;
+  char name[name_length + 1];
+  memcpy(name, arg, name_length);
+  name[name_length] = '\0';
+
+  Figure *base = figure_from_arg(name);
+  if (base == NULL) return 0;
+  if (base->kind != fk_Polyhedron) {
+    printf("Only polyhedra can be placed in grids, which '%s' isn't\n", name);
+    Figure_destroy(base);
+    return 0;
+  }
+
+  // The mesh takes the polyhedron, and its pool, from the figure, which is then done with
+  Polyhedron *polyhedron = base->impl.polyhedron;
+  free(base);
+  return grid_from_mesh(list, Mesh_new(polyhedron), counts);
+}
+
 
 #endif // instances_c_IMPORTED
@@ -1,7 +1,10 @@
 #ifndef intersecor_c_INCLUDED
 #define intersecor_c_INCLUDED
 
+#include <float.h>
+
 #include "line.c"
+#include "../util/arena.c"
 
 /*
 
@@ -15,9 +18,47 @@ where its points are and it tells us.
 
 */
 
+/*
+
+Intersectors may instead (or also) report every interval of a line
+which lies inside the shape, which is what's needed to combine them
+by constructive solid geometry: the union, intersection or difference
+of two such "solid" intersectors is found from their intervals.
+
+*/
+
+// Points p0 + t * (pf - p0) of a line, for t_enter <= t <= t_exit
+typedef struct {
+  float t_enter;
+  float t_exit;
+} Interval;
+
+// More intervals than this along one line are dropped, farthest first
+#define INTERSECTOR_MAX_INTERVALS 8
+
 typedef struct {
-  // In object space
+  int length;
+  // In order along the line, and disjoint
+  Interval items[INTERSECTOR_MAX_INTERVALS];
+} IntervalList;
+
+typedef enum {
+  csg_None,  // Not a CSG node, but a shape of its own
+  csg_Union,
+  csg_Intersection,
+  csg_Difference,
+} CsgOp;
+
+typedef struct Intersector {
+  // In object space. Either may be NULL, but not both, unless this is a CSG node.
   int (*intersect)(v3 *result, Line *line);
+  void (*intervals)(IntervalList *result, Line *line);
+
+  // For CSG nodes, the operands, which belong to the node.
+  // Their transformations take them into the node's object space.
+  CsgOp op;
+  struct Intersector *a;
+  struct Intersector *b;
 
   // bounding box
   v3 min_corner;
@@ -25,41 +66,99 @@ typedef struct {
 
   // object space to world space
   _Mat transformation;
+  // and back, kept up to date with transformation
+  _Mat inverse;
 } Intersector;
 
 
+static Intersector *Intersector_alloc(const v3 min_corner, const v3 max_corner) {
+  Intersector *intersector = malloc(sizeof(Intersector));
+
+  intersector->intersect = NULL;
+  intersector->intervals = NULL;
+  intersector->op = csg_None;
+  intersector->a = NULL;
+  intersector->b = NULL;
+  intersector->min_corner = min_corner;
+  intersector->max_corner = max_corner;
+
+  const _Mat id = Mat_identity();
+  Mat_clone_M(intersector->transformation, id);
+  Mat_clone_M(intersector->inverse, id);
+
+  return intersector;
+}
+
 Intersector *Intersector_new(
   int (*intersect)(v3 *result, Line *line),
   v3 min_corner,
   v3 max_corner
 ) {
-  Intersector *intersecor = malloc(sizeof(Intersector));
-
+  Intersector *intersecor = Intersector_alloc(min_corner, max_corner);
   intersecor->intersect = intersect;
-  intersecor->min_corner = min_corner;
-  intersecor->max_corner = max_corner;
+  return intersecor;
+}
 
-  const _Mat id = Mat_identity();
-  Mat_clone_M(intersecor->transformation, id);
+Intersector *Intersector_new_solid(
+  void (*intervals)(IntervalList *result, Line *line),
+  v3 min_corner,
+  v3 max_corner
+) {
+  /* Make an intersector from its intervals, so that it can be used in CSG */
+  Intersector *intersector = Intersector_alloc(min_corner, max_corner);
+  intersector->intervals = intervals;
+  return intersector;
+}
 
-  return intersecor;
+Intersector *Intersector_clone_in(const Intersector *intersector, Arena *arena) {
+  Intersector *clone = Arena_alloc(arena, sizeof(Intersector));
+  memcpy(clone, intersector, sizeof(Intersector));
+  if (intersector->op != csg_None) {
+    clone->a = Intersector_clone_in(intersector->a, arena);
+    clone->b = Intersector_clone_in(intersector->b, arena);
+  }
+  return clone;
+}
+
+Intersector *Intersector_clone(const Intersector *intersector) {
+  return Intersector_clone_in(intersector, NULL);
 }
 
 void Intersector_destroy(Intersector *intersecor) {
+  if (intersecor->op != csg_None) {
+    Intersector_destroy(intersecor->a);
+    Intersector_destroy(intersecor->b);
+  }
   free(intersecor);
 }
 
 void Intersector_transform(Intersector *intersector, const _Mat transformation) {
   Mat_mult_M(intersector->transformation, intersector->transformation, transformation);
+  Mat_inv_M(intersector->inverse, intersector->transformation);
 }
 
+void Intersector_bounds_M(v3 *lows, v3 *highs, const Intersector *intersector);
+void Intersector_intervals(IntervalList *result, const Intersector *intersector, const Line *line);
+
 int Intersector_intersect(v3 *result, const Intersector *intersector, const Line *line) {
-  _Mat inverse;
-  Mat_inv_M(inverse, intersector->transformation);
+  if (intersector->intersect == NULL) {
+    // Take the nearest boundary in front of line->p0
+    IntervalList intervals;
+    Intersector_intervals(&intervals, intersector, line);
+
+    for (int i = 0; i < intervals.length; i++) {
+      const Interval interval = intervals.items[i];
+      const float t = interval.t_enter >= 0 ? interval.t_enter : interval.t_exit;
+      if (t < 0 || isinf(t)) continue;
+      *result = line->p0 + t * Line_vector(line);
+      return 1;
+    }
+    return 0;
+  }
 
   Line clone;
   memcpy(&clone, line, sizeof(Line));
-  Line_transform(&clone, inverse);
+  Line_transform(&clone, intersector->inverse);
 
   v3 intersection;
   const int got_intersection = intersector->intersect(&intersection, &clone);
@@ -70,8 +169,191 @@ int Intersector_intersect(v3 *result, const Intersector *intersector, const Line
 }
 
 void Intersector_bounds_M(v3 *lows, v3 *highs, const Intersector *intersector) {
-  *lows  = v3_transform(intersector->min_corner, intersector->transformation);
-  *highs = v3_transform(intersector->max_corner, intersector->transformation);
+  // Transform all eight corners of the object-space box, since after
+  // a rotation the two stored corners are no longer the extremes
+  const v3 lo = intersector->min_corner;
+  const v3 hi = intersector->max_corner;
+
+  *lows  = (v3) { +DBL_MAX, +DBL_MAX, +DBL_MAX };
+  *highs = (v3) { -DBL_MAX, -DBL_MAX, -DBL_MAX };
+
+  for (int corner_idx = 0; corner_idx < 8; corner_idx++) {
+    const v3 corner = {
+      (corner_idx & 1) ? hi[0] : lo[0],
+      (corner_idx & 2) ? hi[1] : lo[1],
+      (corner_idx & 4) ? hi[2] : lo[2]
+    };
+    const v3 point = v3_transform(corner, intersector->transformation);
+
+    for (int axis = 0; axis < 3; axis++) {
+      if (point[axis] < (*lows )[axis]) (*lows )[axis] = point[axis];
+      if (point[axis] > (*highs)[axis]) (*highs)[axis] = point[axis];
+    }
+  }
+}
+
+
+// == Intervals and CSG == //
+
+void IntervalList_append(IntervalList *list, const float t_enter, const float t_exit) {
+  /* Add an interval past the end of the list, merging it with the last if they touch */
+  if (t_enter > t_exit) return;
+
+  if (list->length > 0 && t_enter <= list->items[list->length - 1].t_exit) {
+    Interval *last = &list->items[list->length - 1];
+    if (t_exit > last->t_exit) last->t_exit = t_exit;
+    return;
+  }
+
+  if (list->length == INTERSECTOR_MAX_INTERVALS) return;
+  list->items[list->length++] = (Interval) { t_enter, t_exit };
+}
+
+static void IntervalList_union_M(IntervalList *result, const IntervalList *a, const IntervalList *b) {
+  result->length = 0;
+  int i = 0, j = 0;
+  while (i < a->length || j < b->length) {
+    const int take_a = j == b->length || (i < a->length && a->items[i].t_enter <= b->items[j].t_enter);
+    const Interval next = take_a ? a->items[i++] : b->items[j++];
+    IntervalList_append(result, next.t_enter, next.t_exit);
+  }
+}
+
+static void IntervalList_intersection_M(IntervalList *result, const IntervalList *a, const IntervalList *b) {
+  result->length = 0;
+  int i = 0, j = 0;
+  while (i < a->length && j < b->length) {
+    const Interval x = a->items[i];
+    const Interval y = b->items[j];
+    IntervalList_append(result, fmax(x.t_enter, y.t_enter), fmin(x.t_exit, y.t_exit));
+    // Move past whichever ends first
+    if (x.t_exit < y.t_exit) i++; else j++;
+  }
+}
+
+static void IntervalList_difference_M(IntervalList *result, const IntervalList *a, const IntervalList *b) {
+  result->length = 0;
+  int j = 0;
+  for (int i = 0; i < a->length; i++) {
+    float t_enter = a->items[i].t_enter;
+    const float t_exit = a->items[i].t_exit;
+
+    // Skip b's intervals which end before this one starts
+    while (j < b->length && b->items[j].t_exit < t_enter) j++;
+
+    // Cut out each of b's intervals which overlap this one
+    int k = j;
+    while (k < b->length && b->items[k].t_enter <= t_exit) {
+      IntervalList_append(result, t_enter, b->items[k].t_enter);
+      t_enter = fmax(t_enter, b->items[k].t_exit);
+      k++;
+    }
+    IntervalList_append(result, t_enter, t_exit);
+  }
+}
+
+static int box_line_span_M(float *t_enter, float *t_exit, const v3 min_corner, const v3 max_corner, const Line *line) {
+  /* Find the interval of a line within an axis-aligned box. Returns 0 if it misses it */
+  const v3 s = line->p0;
+  const v3 d = Line_vector(line);
+
+  *t_enter = -INFINITY;
+  *t_exit = +INFINITY;
+
+  for (int axis = 0; axis < 3; axis++) {
+    if (d[axis] == 0) {
+      if (s[axis] < min_corner[axis] || s[axis] > max_corner[axis]) return 0;
+      continue;
+    }
+
+    float t0 = (min_corner[axis] - s[axis]) / d[axis];
+    float t1 = (max_corner[axis] - s[axis]) / d[axis];
+    if (t0 > t1) { const float t = t0; t0 = t1; t1 = t; }
+
+    if (t0 > *t_enter) *t_enter = t0;
+    if (t1 < *t_exit ) *t_exit  = t1;
+  }
+
+  return *t_enter <= *t_exit;
+}
+
+void Intersector_intervals(IntervalList *result, const Intersector *intersector, const Line *line) {
+  /* Find the intervals of a line which are inside a solid intersector or CSG node.
+     Since lines are transformed by their points, t means the same in every space */
+  result->length = 0;
+
+  Line clone;
+  memcpy(&clone, line, sizeof(Line));
+  Line_transform(&clone, intersector->inverse);
+
+  // Don't evaluate anything the line doesn't pass near
+  float box_enter, box_exit;
+  if (!box_line_span_M(&box_enter, &box_exit, intersector->min_corner, intersector->max_corner, &clone)) return;
+
+  switch (intersector->op) {
+    case csg_None:
+#ifdef DEBUG
+      if (intersector->intervals == NULL) {
+        printf("intersector has no intervals\n");
+        exit(1);
+      }
+#endif
+      intersector->intervals(result, &clone);
+      return;
+
+    case csg_Union: {
+      IntervalList a, b;
+      Intersector_intervals(&a, intersector->a, &clone);
+      Intersector_intervals(&b, intersector->b, &clone);
+      IntervalList_union_M(result, &a, &b);
+      return;
+    }
+
+    case csg_Intersection: {
+      IntervalList a, b;
+      Intersector_intervals(&a, intersector->a, &clone);
+      if (a.length == 0) return;
+      Intersector_intervals(&b, intersector->b, &clone);
+      IntervalList_intersection_M(result, &a, &b);
+      return;
+    }
+
+    case csg_Difference: {
+      IntervalList a, b;
+      Intersector_intervals(&a, intersector->a, &clone);
+      if (a.length == 0) return;
+      Intersector_intervals(&b, intersector->b, &clone);
+      IntervalList_difference_M(result, &a, &b);
+      return;
+    }
+  }
+}
+
+Intersector *Intersector_csg(const CsgOp op, Intersector *a, Intersector *b) {
+  /* Combine two solid intersectors (or CSG nodes), which then belong to the result */
+
+  v3 a_lows, a_highs, b_lows, b_highs;
+  Intersector_bounds_M(&a_lows, &a_highs, a);
+  Intersector_bounds_M(&b_lows, &b_highs, b);
+
+  v3 min_corner = a_lows;
+  v3 max_corner = a_highs;
+  for (int axis = 0; axis < 3; axis++) {
+    if (op == csg_Union) {
+      min_corner[axis] = fmin(a_lows[axis], b_lows[axis]);
+      max_corner[axis] = fmax(a_highs[axis], b_highs[axis]);
+    } else if (op == csg_Intersection) {
+      min_corner[axis] = fmax(a_lows[axis], b_lows[axis]);
+      max_corner[axis] = fmin(a_highs[axis], b_highs[axis]);
+    }
+    // A difference is within its first operand
+  }
+
+  Intersector *node = Intersector_alloc(min_corner, max_corner);
+  node->op = op;
+  node->a = a;
+  node->b = b;
+  return node;
 }
 
 
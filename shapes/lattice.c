@@ -49,7 +49,20 @@ void Lattice_transform(Lattice *lattice, const _Mat transformation) {
   }
 }
 
+Lattice *Lattice_clone_in(const Lattice *lattice, Arena *arena) {
+  Lattice *clone = Arena_alloc(arena, sizeof(Lattice));
+  clone->points = LatticePoints_clone_in(lattice->points, arena);
+  clone->width = lattice->width;
+  clone->height = lattice->height;
+  return clone;
+}
+
+Lattice *Lattice_clone(const Lattice *lattice) {
+  return Lattice_clone_in(lattice, NULL);
+}
+
 void Lattice_destroy(Lattice *lattice) {
+  /* Destroy a lattice made on the heap; one made in an arena goes with the arena */
   Dyn_destroy(lattice->points);
   free(lattice);
 }
@@ -121,11 +134,11 @@ void Lattice_bounds_M(v3 *lows, v3 *highs, const Lattice *lattice) {
     const float z = point[2];
 
          if (x < (*lows )[0]) (*lows )[0] = x;
-    else if (x > (*highs)[0]) (*highs)[0] = x;
+         if (x > (*highs)[0]) (*highs)[0] = x;
          if (y < (*lows )[1]) (*lows )[1] = y;
-    else if (y > (*highs)[1]) (*highs)[1] = y;
+         if (y > (*highs)[1]) (*highs)[1] = y;
          if (z < (*lows )[2]) (*lows )[2] = z;
-    else if (z > (*highs)[2]) (*highs)[2] = z;
+         if (z > (*highs)[2]) (*highs)[2] = z;
   }
 }
 
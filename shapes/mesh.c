@@ -0,0 +1,125 @@
+#ifndef mesh_c_INCLUDED
+#define mesh_c_INCLUDED
+
+// Instanced geometry
+//
+// A Mesh is a polyhedron which never changes, shared by any number of
+// MeshInstances. Each instance is only a placement of the mesh, with a
+// transformation and a color of its own, so many copies of one model
+// cost a matrix each rather than a copy of every polygon. Instances are
+// drawn by transforming the mesh's polygons one at a time as they go
+// (see MeshInstance_render_range in render.c).
+
+#include <float.h>
+
+#include "../matrix.c"
+#include "v3.c"
+#include "polyhedron.c"
+
+typedef struct {
+  // In object space. Belongs to the mesh, as does the arena it's in, if any
+  Polyhedron *polyhedron;
+
+  // Bounding box of the polyhedron, found once
+  v3 min_corner;
+  v3 max_corner;
+
+  // Instances referring to the mesh. It's freed along with the last of them
+  int reference_count;
+} Mesh;
+
+typedef struct {
+  Mesh *mesh;
+  v3 color;
+
+  // object space to world space
+  _Mat transformation;
+} MeshInstance;
+
+Mesh *Mesh_new(Polyhedron *polyhedron) {
+  /* Make a mesh of a polyhedron, which then belongs to it and mustn't be changed */
+  Mesh *mesh = malloc(sizeof(Mesh));
+  mesh->polyhedron = polyhedron;
+  mesh->reference_count = 0;
+  Polyhedron_bounds_M(&mesh->min_corner, &mesh->max_corner, polyhedron);
+  return mesh;
+}
+
+void Mesh_release(Mesh *mesh) {
+  /* Drop a reference to the mesh, freeing it if that was the last */
+  if (--mesh->reference_count > 0) return;
+
+  Arena *pool = mesh->polyhedron->arena;
+  Polyhedron_destroy(mesh->polyhedron);
+  if (pool != NULL) Arena_destroy(pool);
+  free(mesh);
+}
+
+MeshInstance *MeshInstance_new(Mesh *mesh, const v3 color) {
+  MeshInstance *instance = malloc(sizeof(MeshInstance));
+  instance->mesh = mesh;
+  instance->color = color;
+  mesh->reference_count++;
+
+  const _Mat id = Mat_identity();
+  Mat_clone_M(instance->transformation, id);
+
+  return instance;
+}
+
+MeshInstance *MeshInstance_clone_in(const MeshInstance *instance, Arena *arena) {
+  /* The clone shares the mesh. Only clones on the heap hold a reference to it,
+     since clones in an arena are never destroyed */
+  MeshInstance *clone = Arena_alloc(arena, sizeof(MeshInstance));
+  memcpy(clone, instance, sizeof(MeshInstance));
+  if (arena == NULL) clone->mesh->reference_count++;
+  return clone;
+}
+
+MeshInstance *MeshInstance_clone(const MeshInstance *instance) {
+  return MeshInstance_clone_in(instance, NULL);
+}
+
+void MeshInstance_destroy(MeshInstance *instance) {
+  Mesh_release(instance->mesh);
+  free(instance);
+}
+
+void MeshInstance_transform(MeshInstance *instance, const _Mat transformation) {
+  Mat_mult_M(instance->transformation, transformation, instance->transformation);
+}
+
+void MeshInstance_bounds_M(v3 *lows, v3 *highs, const MeshInstance *instance) {
+  const v3 lo = instance->mesh->min_corner;
+  const v3 hi = instance->mesh->max_corner;
+
+  *lows  = (v3) { +DBL_MAX, +DBL_MAX, +DBL_MAX };
+  *highs = (v3) { -DBL_MAX, -DBL_MAX, -DBL_MAX };
+
+  for (int corner_idx = 0; corner_idx < 8; corner_idx++) {
+    const v3 corner = {
+      (corner_idx & 1) ? hi[0] : lo[0],
+      (corner_idx & 2) ? hi[1] : lo[1],
+      (corner_idx & 4) ? hi[2] : lo[2]
+    };
+    const v3 point = v3_transform(corner, instance->transformation);
+
+    for (int axis = 0; axis < 3; axis++) {
+      if (point[axis] < (*lows )[axis]) (*lows )[axis] = point[axis];
+      if (point[axis] > (*highs)[axis]) (*highs)[axis] = point[axis];
+    }
+  }
+}
+
+void MeshInstance_place_polygon(Polygon *result, const MeshInstance *instance, const int polygon_idx, Arena *arena) {
+  /* Initialize result to one of the mesh's polygons, as placed by the instance.
+     Triangles and quads fit inline; larger polygons spill into arena */
+  const Polygon *polygon = Polyhedron_get(instance->mesh->polyhedron, polygon_idx);
+  Polygon_init_in(result, polygon->length, arena);
+  for (int point_idx = 0; point_idx < polygon->length; point_idx++) {
+    Polygon_append(result, v3_transform(Polygon_get(polygon, point_idx), instance->transformation));
+  }
+}
+
+
+#endif // mesh_c_INCLUDED
@@ -2,6 +2,8 @@
 #define observer_figure_c_INCLUDED
 
 #include "v3.c"
+#include "../matrix.c"
+#include "../util/arena.c"
 
 // Special-case figure containing the information
 // for the observer, which is given by a position,
@@ -12,6 +14,11 @@ typedef struct Observer {
   v3 position;
   v3 interest;
   v3 up_point;
+
+  // World space to eye space, as of the last time it was needed
+  // (see calc_eyespace_matrix_M). Stale once the observer moves.
+  int eyespace_stale;
+  _Mat to_eyespace;
 } Observer;
 
 Observer *Observer_new() {
@@ -19,9 +26,20 @@ Observer *Observer_new() {
   ob->position = (v3) { 0, 0, 0 };
   ob->up_point = (v3) { 0, 1, 0 };
   ob->interest = (v3) { 0, 0, 1 };
+  ob->eyespace_stale = 1;
   return ob;
 }
 
+Observer *Observer_clone_in(const Observer *observer, Arena *arena) {
+  Observer *clone = Arena_alloc(arena, sizeof(Observer));
+  memcpy(clone, observer, sizeof(Observer));
+  return clone;
+}
+
+Observer *Observer_clone(const Observer *observer) {
+  return Observer_clone_in(observer, NULL);
+}
+
 void Observer_destroy(Observer *observer) {
   free(observer);
 }
@@ -30,6 +48,7 @@ void Observer_transform(Observer *observer, const _Mat transformation) {
   observer->position = v3_transform(observer->position, transformation);
   observer->interest = v3_transform(observer->interest, transformation);
   observer->up_point = v3_transform(observer->up_point, transformation);
+  observer->eyespace_stale = 1;
 }
 
 void Observer_bounds_M(v3 *lows, v3 *highs, const Observer *observer) {
@@ -4,11 +4,14 @@
 // Polygongon data structure
 
 #include <float.h>
+#include <stdarg.h>
 
 #include "v3.c"
 
 #include "../util/dyn.c"
-DYN_INIT(Polygon, v3);
+// Almost all polygons are triangles or quads, and clipping
+// a corner off a quad gives five points, so those are kept inline
+DYN_INIT_INLINE(Polygon, v3, 5);
 
 void Polygon_print(const Polygon* polygon) {
   printf("POLY [\n");
@@ -21,7 +24,7 @@ void Polygon_print(const Polygon* polygon) {
 }
 
 void Polygon_destroy(Polygon *polygon) {
-  Dyn_destroy(polygon);
+  Polygon_shallow_destroy(polygon);
 }
 
 v3 Polygon_center(const Polygon *polygon) {
@@ -111,19 +114,29 @@ Polygon *Polygon_from_parametric(
 
 }
 
-Polygon *Polygon_from_points(const int point_count, ...) {
-  Polygon *polygon = Polygon_new(point_count);
-
-  va_list args;
-  va_start(args, point_count);
-
+static Polygon *Polygon_from_point_list_in(Arena *arena, const int point_count, va_list args) {
+  Polygon *polygon = Polygon_new_in(point_count, arena);
   for (int i = 0; i < point_count; i++) {
     v3 point = va_arg(args, v3);
     Polygon_append(polygon, point);
   }
+  return polygon;
+}
 
+Polygon *Polygon_from_points(const int point_count, ...) {
+  va_list args;
+  va_start(args, point_count);
+  Polygon *polygon = Polygon_from_point_list_in(NULL, point_count, args);
   va_end(args);
+  return polygon;
+}
 
+Polygon *Polygon_from_points_in(Arena *arena, const int point_count, ...) {
+  /* Like Polygon_from_points, but allocating in an arena */
+  va_list args;
+  va_start(args, point_count);
+  Polygon *polygon = Polygon_from_point_list_in(arena, point_count, args);
+  va_end(args);
   return polygon;
 }
 
@@ -27,7 +27,22 @@ void Polyhedron_transform(Polyhedron *polyhedron, const _Mat transformation) {
   }
 }
 
+Polyhedron *Polyhedron_deep_clone_in(const Polyhedron *polyhedron, Arena *arena) {
+  Polyhedron *clone = Polyhedron_new_in(polyhedron->length, arena);
+  for (int i = 0; i < polyhedron->length; i++) {
+    Polyhedron_append(clone, Polygon_clone_in(Polyhedron_get(polyhedron, i), arena));
+  }
+  return clone;
+}
+
+Polyhedron *Polyhedron_deep_clone(const Polyhedron *polyhedron) {
+  return Polyhedron_deep_clone_in(polyhedron, NULL);
+}
+
 void Polyhedron_destroy(Polyhedron *polyhedron) {
+  // A polyhedron in an arena, polygons and all, is freed with the arena
+  if (polyhedron->arena != NULL) return;
+
   for (int i = 0; i < polyhedron->length; i++) {
     Polygon_destroy(Polyhedron_get(polyhedron, i));
   }
@@ -55,11 +70,11 @@ void Polyhedron_bounds_M(v3 *lows, v3 *highs, const Polyhedron *polyhedron) {
       const float z = point[2];
 
            if (x < (*lows )[0]) (*lows )[0] = x;
-      else if (x > (*highs)[0]) (*highs)[0] = x;
+           if (x > (*highs)[0]) (*highs)[0] = x;
            if (y < (*lows )[1]) (*lows )[1] = y;
-      else if (y > (*highs)[1]) (*highs)[1] = y;
+           if (y > (*highs)[1]) (*highs)[1] = y;
            if (z < (*lows )[2]) (*lows )[2] = z;
-      else if (z > (*highs)[2]) (*highs)[2] = z;
+           if (z > (*highs)[2]) (*highs)[2] = z;
     }
   }
 }
@@ -89,14 +104,20 @@ Polyhedron *load_polyhedron(const char *filename) {
   int polyhedron_polygon_count;
   fscanf(file, "%d", &polyhedron_polygon_count);
 
-  Polyhedron *polyhedron = Polyhedron_new(polyhedron_polygon_count);
+  // The polyhedron lives in a pool of its own, which starts out
+  // large enough for a mesh of triangles and quads
+  Arena *pool = Arena_new(
+      sizeof(Polyhedron)
+    + polyhedron_polygon_count * (sizeof(Polygon*) + sizeof(Polygon) + ARENA_ALIGN)
+  );
+  Polyhedron *polyhedron = Polyhedron_new_in(polyhedron_polygon_count, pool);
 
   for (int polygon_idx = 0; polygon_idx < polyhedron_polygon_count; polygon_idx++) {
 
     int polygon_point_count;
     fscanf(file, "%d", &polygon_point_count);
 
-    Polygon *polygon = Polygon_new(polygon_point_count);
+    Polygon *polygon = Polygon_new_in(polygon_point_count, pool);
 
     for (int point_idx = 0; point_idx < polygon_point_count; point_idx++) {
       int crossref_idx;
@@ -167,10 +188,17 @@ Polyhedron *Polyhedron_from_parametric(
 
   // Each quadruplet of adjacent items becomes a polygongon
 
-  Polyhedron *polyhedron = Polyhedron_new(t_count * s_count);
   // t_count * s_count is the length if wrapping in both directions.
   // Thus it acts as an upper bound for all cases,
   // with maximum error t_count + s_count + 1, which is pretty low
+  const size_t max_polygon_count = (size_t) t_count * (size_t) s_count;
+
+  // The polyhedron lives in a pool of its own, sized to fit exactly
+  Arena *pool = Arena_new(
+      sizeof(Polyhedron)
+    + max_polygon_count * (sizeof(Polygon*) + sizeof(Polygon) + ARENA_ALIGN)
+  );
+  Polyhedron *polyhedron = Polyhedron_new_in(max_polygon_count, pool);
 
   for (int t_idx = 0; t_idx < t_count - 1; t_idx++) {
     for (int s_idx = 0; s_idx < s_count - 1; s_idx++) {
@@ -179,7 +207,7 @@ Polyhedron *Polyhedron_from_parametric(
       const v3 bottom_left  = point_at(t_idx    , s_idx + 1);
       const v3 bottom_right = point_at(t_idx + 1, s_idx + 1);
 
-      Polygon *polygon = Polygon_from_points(4, top_left, top_right, bottom_right, bottom_left);
+      Polygon *polygon = Polygon_from_points_in(pool, 4, top_left, top_right, bottom_right, bottom_left);
       Polyhedron_append(polyhedron, polygon);
     }
   }
@@ -191,7 +219,7 @@ Polyhedron *Polyhedron_from_parametric(
       const v3 bottom_left  = point_at(t_count - 1, s_idx + 1);
       const v3 bottom_right = point_at(0          , s_idx + 1);
 
-      Polygon *polygon = Polygon_from_points(4, top_left, top_right, bottom_right, bottom_left);
+      Polygon *polygon = Polygon_from_points_in(pool, 4, top_left, top_right, bottom_right, bottom_left);
       Polyhedron_append(polyhedron, polygon);
     }
   }
@@ -203,7 +231,7 @@ Polyhedron *Polyhedron_from_parametric(
       const v3 bottom_left  = point_at(t_idx    , 0          );
       const v3 bottom_right = point_at(t_idx + 1, 0          );
 
-      Polygon *polygon = Polygon_from_points(4, top_left, top_right, bottom_right, bottom_left);
+      Polygon *polygon = Polygon_from_points_in(pool, 4, top_left, top_right, bottom_right, bottom_left);
       Polyhedron_append(polyhedron, polygon);
     }
   }
@@ -214,7 +242,7 @@ Polyhedron *Polyhedron_from_parametric(
     const v3 bottom_left  = point_at(t_count - 1, 0          );
     const v3 bottom_right = point_at(0          , 0          );
 
-    Polygon *polygon = Polygon_from_points(4, top_left, top_right, bottom_left, bottom_right);
+    Polygon *polygon = Polygon_from_points_in(pool, 4, top_left, top_right, bottom_left, bottom_right);
     Polyhedron_append(polyhedron, polygon);
   }
 
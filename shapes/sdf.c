@@ -0,0 +1,326 @@
+#ifndef sdf_c_INCLUDED
+#define sdf_c_INCLUDED
+
+#include <float.h>
+#include <math.h>
+
+#include "line.c"
+#include "../util/arena.c"
+
+/*
+
+An Sdf is a shape given by a signed distance function: the distance
+from any point to the shape's surface, negative inside it. Nothing
+needs solving in closed form, so shapes are cheap to make, and
+they compose: the union of two shapes is the min of their distances.
+
+Lines are intersected with an Sdf by sphere tracing. Stepping along
+the line by the distance to the surface can never overshoot it, and
+the steps shrink as the surface nears.
+
+The distance function is a small tree of nodes, built bottom-up by the
+functions below, each of which returns the index of the node it made.
+The last node made is the root.
+
+*/
+
+#define SDF_MAX_NODES 16
+
+typedef enum {
+  // Primitives, about their center
+  sdf_Sphere,
+  sdf_Box,
+  sdf_Torus,
+  // A user-supplied distance function
+  sdf_Custom,
+  // Compositions of two nodes
+  sdf_Union,
+  sdf_Intersection,
+  sdf_SmoothUnion,
+} SdfOp;
+
+typedef struct {
+  SdfOp op;
+  v3 center;
+  // Radius of a sphere; half the size of a box;
+  // major and minor radius of a torus around the y axis
+  v3 size;
+  float (*distance)(v3 point);
+  // Operands of a composition
+  int a;
+  int b;
+  // Width of the blend of a smooth union
+  float smoothing;
+} SdfNode;
+
+typedef struct {
+  SdfNode nodes[SDF_MAX_NODES];
+  int node_count;
+
+  // Bounding box, in object space. The shape must lie within it.
+  v3 min_corner;
+  v3 max_corner;
+
+  // object space to world space
+  _Mat transformation;
+  // and back, kept up to date with transformation
+  _Mat inverse;
+  // and what normals go by, likewise (see Mat_normal_M)
+  _Mat normal_transformation;
+} Sdf;
+
+// Sphere tracing parameters. Distances are in object space.
+const int   sdf_max_steps = 128;
+// How close to the surface counts as on it, relative to the bounding box's size
+const float sdf_epsilon = 1e-4;
+// Steps are lengthened by this factor while that's safe (see Sdf_trace_M)
+const float sdf_relaxation = 1.6;
+
+Sdf *Sdf_new(const v3 min_corner, const v3 max_corner) {
+  Sdf *sdf = malloc(sizeof(Sdf));
+
+  sdf->node_count = 0;
+  sdf->min_corner = min_corner;
+  sdf->max_corner = max_corner;
+
+  const _Mat id = Mat_identity();
+  Mat_clone_M(sdf->transformation, id);
+  Mat_clone_M(sdf->inverse, id);
+  Mat_clone_M(sdf->normal_transformation, id);
+
+  return sdf;
+}
+
+Sdf *Sdf_clone_in(const Sdf *sdf, Arena *arena) {
+  Sdf *clone = Arena_alloc(arena, sizeof(Sdf));
+  memcpy(clone, sdf, sizeof(Sdf));
+  return clone;
+}
+
+Sdf *Sdf_clone(const Sdf *sdf) {
+  return Sdf_clone_in(sdf, NULL);
+}
+
+void Sdf_destroy(Sdf *sdf) {
+  free(sdf);
+}
+
+static int Sdf_add_node(Sdf *sdf, const SdfNode node) {
+#ifdef DEBUG
+  if (sdf->node_count >= SDF_MAX_NODES) {
+    printf("too many sdf nodes\n");
+    exit(1);
+  }
+  if (node.op >= sdf_Union && (node.a >= sdf->node_count || node.b >= sdf->node_count)) {
+    printf("sdf node refers to a node not yet made\n");
+    exit(1);
+  }
+#endif
+
+  sdf->nodes[sdf->node_count] = node;
+  return sdf->node_count++;
+}
+
+int Sdf_sphere(Sdf *sdf, const v3 center, const float radius) {
+  return Sdf_add_node(sdf, (SdfNode) { .op = sdf_Sphere, .center = center, .size = { radius, 0, 0 } });
+}
+
+int Sdf_box(Sdf *sdf, const v3 center, const v3 half_size) {
+  return Sdf_add_node(sdf, (SdfNode) { .op = sdf_Box, .center = center, .size = half_size });
+}
+
+int Sdf_torus(Sdf *sdf, const v3 center, const float major_radius, const float minor_radius) {
+  return Sdf_add_node(sdf, (SdfNode) { .op = sdf_Torus, .center = center, .size = { major_radius, minor_radius, 0 } });
+}
+
+int Sdf_custom(Sdf *sdf, float (*distance)(v3 point)) {
+  return Sdf_add_node(sdf, (SdfNode) { .op = sdf_Custom, .distance = distance });
+}
+
+int Sdf_union(Sdf *sdf, const int a, const int b) {
+  return Sdf_add_node(sdf, (SdfNode) { .op = sdf_Union, .a = a, .b = b });
+}
+
+int Sdf_intersection(Sdf *sdf, const int a, const int b) {
+  return Sdf_add_node(sdf, (SdfNode) { .op = sdf_Intersection, .a = a, .b = b });
+}
+
+int Sdf_smooth_union(Sdf *sdf, const int a, const int b, const float smoothing) {
+  return Sdf_add_node(sdf, (SdfNode) { .op = sdf_SmoothUnion, .a = a, .b = b, .smoothing = smoothing });
+}
+
+float smooth_min(const float a, const float b, const float k) {
+  /* Polynomial smooth minimum: min(a, b), rounded off where a and b are within k */
+  if (k <= 0) return fmin(a, b);
+  const float h = fmax(k - fabs(a - b), 0) / k;
+  return fmin(a, b) - h * h * k / 4;
+}
+
+static float Sdf_node_distance(const Sdf *sdf, const int node_i, const v3 point) {
+  const SdfNode *node = &sdf->nodes[node_i];
+  const v3 p = point - node->center;
+
+  switch (node->op) {
+    case sdf_Sphere:
+      return sqrt(v3_dot(p, p)) - node->size[0];
+
+    case sdf_Box: {
+      const v3 q = { fabs(p[0]) - node->size[0], fabs(p[1]) - node->size[1], fabs(p[2]) - node->size[2] };
+      const v3 outside = { fmax(q[0], 0), fmax(q[1], 0), fmax(q[2], 0) };
+      return sqrt(v3_dot(outside, outside)) + fmin(fmax(q[0], fmax(q[1], q[2])), 0);
+    }
+
+    case sdf_Torus: {
+      const float ring = sqrt(p[0] * p[0] + p[2] * p[2]) - node->size[0];
+      return sqrt(ring * ring + p[1] * p[1]) - node->size[1];
+    }
+
+    case sdf_Custom:
+      return node->distance(point);
+
+    case sdf_Union:
+      return fmin(Sdf_node_distance(sdf, node->a, point), Sdf_node_distance(sdf, node->b, point));
+
+    case sdf_Intersection:
+      return fmax(Sdf_node_distance(sdf, node->a, point), Sdf_node_distance(sdf, node->b, point));
+
+    case sdf_SmoothUnion:
+      return smooth_min(Sdf_node_distance(sdf, node->a, point), Sdf_node_distance(sdf, node->b, point), node->smoothing);
+  }
+
+  return INFINITY;
+}
+
+float Sdf_distance(const Sdf *sdf, const v3 point) {
+  /* Signed distance from an object-space point to the shape */
+  return Sdf_node_distance(sdf, sdf->node_count - 1, point);
+}
+
+void Sdf_transform(Sdf *sdf, const _Mat transformation) {
+  Mat_mult_M(sdf->transformation, transformation, sdf->transformation);
+  Mat_inv_M(sdf->inverse, sdf->transformation);
+  Mat_normal_M(sdf->normal_transformation, sdf->transformation);
+}
+
+void Sdf_bounds_M(v3 *lows, v3 *highs, const Sdf *sdf) {
+  const v3 lo = sdf->min_corner;
+  const v3 hi = sdf->max_corner;
+
+  *lows  = (v3) { +DBL_MAX, +DBL_MAX, +DBL_MAX };
+  *highs = (v3) { -DBL_MAX, -DBL_MAX, -DBL_MAX };
+
+  for (int corner_idx = 0; corner_idx < 8; corner_idx++) {
+    const v3 corner = {
+      (corner_idx & 1) ? hi[0] : lo[0],
+      (corner_idx & 2) ? hi[1] : lo[1],
+      (corner_idx & 4) ? hi[2] : lo[2]
+    };
+    const v3 point = v3_transform(corner, sdf->transformation);
+
+    for (int axis = 0; axis < 3; axis++) {
+      if (point[axis] < (*lows )[axis]) (*lows )[axis] = point[axis];
+      if (point[axis] > (*highs)[axis]) (*highs)[axis] = point[axis];
+    }
+  }
+}
+
+static int Sdf_box_span_M(float *t_enter, float *t_exit, const Sdf *sdf, const v3 origin, const v3 direction) {
+  /* Find where a ray enters and leaves the bounding box. Returns 0 if it misses it */
+  *t_enter = 0;
+  *t_exit = INFINITY;
+
+  for (int axis = 0; axis < 3; axis++) {
+    if (direction[axis] == 0) {
+      if (origin[axis] < sdf->min_corner[axis] || origin[axis] > sdf->max_corner[axis]) return 0;
+      continue;
+    }
+
+    float t0 = (sdf->min_corner[axis] - origin[axis]) / direction[axis];
+    float t1 = (sdf->max_corner[axis] - origin[axis]) / direction[axis];
+    if (t0 > t1) { const float t = t0; t0 = t1; t1 = t; }
+
+    if (t0 > *t_enter) *t_enter = t0;
+    if (t1 < *t_exit ) *t_exit  = t1;
+  }
+
+  return *t_enter <= *t_exit;
+}
+
+int Sdf_trace_M(float *t_hit, const Sdf *sdf, const v3 origin, const v3 direction) {
+  /* Sphere-trace an object-space ray, with unit direction, from where it enters
+     the bounding box to where it leaves it. Returns 0 if it misses the shape */
+
+  float t, t_exit;
+  if (!Sdf_box_span_M(&t, &t_exit, sdf, origin, direction)) return 0;
+
+  const float epsilon = sdf_epsilon * v3_mag(sdf->max_corner - sdf->min_corner);
+
+  // Over-relaxed sphere tracing (Keinert et al., "Enhanced Sphere Tracing"):
+  // take steps longer than the distance, which is safe as long as the
+  // unbounding spheres at either end of the step overlap. If they don't,
+  // the step may have passed the surface, so go back and stop relaxing.
+  float relaxation = sdf_relaxation;
+  float step = 0;
+  float previous_radius = 0;
+
+  for (int step_i = 0; step_i < sdf_max_steps; step_i++) {
+    const float distance = Sdf_distance(sdf, origin + t * direction);
+    const float radius = fabs(distance);
+
+    const int overstepped = relaxation > 1 && radius + previous_radius < step;
+    if (overstepped) {
+      step -= relaxation * step;
+      relaxation = 1;
+    } else {
+      if (radius < epsilon) {
+        *t_hit = t;
+        return 1;
+      }
+      step = distance * relaxation;
+    }
+
+    previous_radius = radius;
+    t += step;
+    if (t > t_exit) return 0;
+  }
+
+  return 0;
+}
+
+int Sdf_intersect(v3 *result, const Sdf *sdf, const Line *line) {
+  /* Find the nearest point of the shape on the ray from line->p0 through line->pf */
+  const v3 origin = v3_transform(line->p0, sdf->inverse);
+  const v3 direction = v3_normalize(v3_transform(line->pf, sdf->inverse) - origin);
+
+  float t;
+  if (!Sdf_trace_M(&t, sdf, origin, direction)) return 0;
+
+  *result = v3_transform(origin + t * direction, sdf->transformation);
+  return 1;
+}
+
+int Sdf_normal(v3 *result, const Sdf *sdf, const v3 point) {
+  /* Unit normal at a point on the surface, from the gradient of the distance */
+  const v3 p = v3_transform(point, sdf->inverse);
+  const float h = sdf_epsilon * v3_mag(sdf->max_corner - sdf->min_corner);
+
+  // Sampling at the corners of a tetrahedron takes four distances rather than six
+  const v3 k0 = { +1, -1, -1 };
+  const v3 k1 = { -1, -1, +1 };
+  const v3 k2 = { -1, +1, -1 };
+  const v3 k3 = { +1, +1, +1 };
+  const v3 gradient =
+      k0 * Sdf_distance(sdf, p + h * k0)
+    + k1 * Sdf_distance(sdf, p + h * k1)
+    + k2 * Sdf_distance(sdf, p + h * k2)
+    + k3 * Sdf_distance(sdf, p + h * k3);
+
+  const v3 normal = v3_transform(gradient, sdf->normal_transformation);
+
+  if (v3_eq(normal, v3_zero)) return 0;
+  *result = v3_normalize(normal);
+  return 1;
+}
+
+
+#endif // sdf_c_INCLUDED
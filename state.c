@@ -20,6 +20,12 @@ int   DO_BACKFACE_ELIMINATION   = 0;
 int   DO_HALO                   = 1;
 int   DO_CLIPPING               = 1;
 int   DO_BOUNDING_BOXES         = 0;
+int   DO_OCCLUSION_CULLING      = 1;
+int   DO_DAMAGE_TRACKING        = 1;
+int   DO_PARALLEL_RENDER        = 1;
+int   DO_ADAPTIVE_SAMPLING      = 0;
+int   DO_EDGE_RASTER            = 1;
+int   DO_DEFERRED_SHADING       = 0;
 
 int   BACKFACE_ELIMINATION_SIGN = 1;
 
@@ -35,12 +41,23 @@ float HITHER                    = 1;
 //Threshold for which objects too far from the observer aren't shown
 float YON                       = 30;
 
+// How different the corners of a block of intersector pixels may be
+// for the block to be interpolated rather than sampled further
+float SAMPLING_TOLERANCE        = 0.05;
+
 
 // == Current World State == //
 
 #include "util/dyn.c"
 DYN_INIT(FigureList, Figure*);
 
+void FigureList_destroy(FigureList *figures) {
+  for (int polyhedron_idx = 0; polyhedron_idx < figures->length; polyhedron_idx++) {
+    Figure_destroy(FigureList_get(figures, polyhedron_idx));
+  }
+  Dyn_destroy(figures);
+}
+
 // All the figures in the world
 FigureList *figures;
 // The light source
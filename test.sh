@@ -0,0 +1,21 @@
+#!/bin/bash
+
+# Build and run every test in tests/, stopping with an error if any fails.
+#
+# Call like e.g.
+# ./test.sh
+# ./test.sh -O3 -DDEBUG
+# to pass extra arguments to clang.
+
+status=0
+for test in tests/*.c; do
+  name=$(basename "$test" .c)
+  [ "$name" = check ] && continue
+
+  command="clang -I./bench/headless -Werror $@ $test -lm -pthread -o tests/$name.out"
+  echo "build command: $command" >&2
+  eval "$command" || { status=1; continue; }
+  ./tests/$name.out || status=1
+done
+
+exit $status
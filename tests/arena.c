@@ -0,0 +1,165 @@
+// Tests of arenas (util/arena.c), and of cloning lists and polyhedra into them
+//
+// Geometry owned by a figure is cloned into an arena of its own, and frame
+// scratch is allocated from an arena which is reset every frame, so clones
+// must be deep and independent, and a reset arena must not grow again.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "check.c"
+#include "../matrix.c"
+#include "../shapes/polyhedron.c"
+#include "../util/arena.c"
+
+DYN_INIT(IntList, int)
+
+// Points inline in every Polygon
+const int inline_count = sizeof(((Polygon*) NULL)->inline_items) / sizeof(v3);
+
+v3 test_point(const int i) {
+  return (v3) { i, 2 * i, 3 * i };
+}
+
+int polygon_holds_test_points(const Polygon *polygon, const int count, const int offset) {
+  /* Does the polygon hold test points offset through offset + count - 1? */
+  if (polygon->length != count) return 0;
+  for (int i = 0; i < count; i++) {
+    const v3 point = Polygon_get(polygon, i);
+    const v3 expected = test_point(offset + i);
+    if (point[0] != expected[0] || point[1] != expected[1] || point[2] != expected[2]) return 0;
+  }
+  return 1;
+}
+
+int block_count(const Arena *arena) {
+  int count = 0;
+  for (const ArenaBlock *block = arena->blocks; block != NULL; block = block->next) count++;
+  return count;
+}
+
+void check_reset() {
+  Arena *arena = Arena_new(64);
+
+  // Allocations are aligned and don't overlap, across several blocks
+  const int sizes[] = { 1, 17, 3, 64, 200, 5, 1000, 8 };
+  const int size_count = sizeof(sizes) / sizeof(sizes[0]);
+  unsigned char *allocations[size_count];
+  for (int i = 0; i < size_count; i++) {
+    allocations[i] = Arena_alloc(arena, sizes[i]);
+    CHECK((uintptr_t) allocations[i] % ARENA_ALIGN == 0, "allocation %d of %d bytes is unaligned", i, sizes[i]);
+    for (int j = 0; j < sizes[i]; j++) allocations[i][j] = i;
+  }
+  int overwritten = 0;
+  for (int i = 0; i < size_count; i++) {
+    for (int j = 0; j < sizes[i]; j++) overwritten += allocations[i][j] != i;
+  }
+  CHECK(overwritten == 0, "%d byte(s) of allocations overwritten by later ones", overwritten);
+  CHECK(block_count(arena) > 1, "a small arena took several blocks");
+
+  // Once reset, the same allocations fit in the one block it keeps
+  const size_t used = Arena_used(arena);
+  Arena_reset(arena);
+  CHECK(Arena_used(arena) == 0, "a reset arena has %zu byte(s) used", Arena_used(arena));
+  CHECK(block_count(arena) == 1, "a reset arena has %d blocks", block_count(arena));
+  const ArenaBlock *block = arena->blocks;
+  for (int i = 0; i < size_count; i++) Arena_alloc(arena, sizes[i]);
+  CHECK(arena->blocks == block && block_count(arena) == 1, "the arena grew again after being reset");
+  CHECK(Arena_used(arena) == used, "the same allocations used %zu bytes, then %zu", used, Arena_used(arena));
+
+  Arena_destroy(arena);
+}
+
+void check_clone_in() {
+  IntList *list = IntList_new(4);
+  for (int i = 0; i < 100; i++) IntList_append(list, i);
+
+  Arena *arena = Arena_new(1 << 10);
+  IntList *clone = IntList_clone_in(list, arena);
+  CHECK(clone->arena == arena, "the clone belongs to the arena");
+  CHECK(clone->items != list->items, "the clone has items of its own");
+  CHECK(clone->length == 100, "the clone has every item, not %zu", clone->length);
+
+  int all_equal = 1;
+  for (int i = 0; i < 100; i++) all_equal &= IntList_get(clone, i) == i;
+  CHECK(all_equal, "the clone's items are the list's");
+
+  // Changes to either don't reach the other
+  IntList_set(list, 0, -1);
+  IntList_set(clone, 1, -1);
+  CHECK(IntList_get(clone, 0) == 0, "the clone is unchanged by setting the list");
+  CHECK(IntList_get(list, 1) == 1, "the list is unchanged by setting the clone");
+
+  // The clone grows within the arena
+  for (int i = 100; i < 1000; i++) IntList_append(clone, i);
+  all_equal = 1;
+  for (int i = 2; i < 1000; i++) all_equal &= IntList_get(clone, i) == i;
+  CHECK(all_equal, "the clone keeps its items while growing in the arena");
+  CHECK(list->length == 100, "the list is unchanged by growing the clone");
+
+  // Destroying a list in an arena leaves it to the arena
+  Dyn_destroy(clone);
+  Dyn_destroy(list);
+  Arena_destroy(arena);
+}
+
+Polyhedron *test_polyhedron() {
+  /* A triangle, a quad, and a polygon too long to be inline */
+  Polyhedron *polyhedron = Polyhedron_new(3);
+  const int lengths[] = { 3, 4, inline_count + 3 };
+  for (int polygon_i = 0; polygon_i < 3; polygon_i++) {
+    Polygon *polygon = Polygon_new(0);
+    for (int i = 0; i < lengths[polygon_i]; i++) Polygon_append(polygon, test_point(10 * polygon_i + i));
+    Polyhedron_append(polyhedron, polygon);
+  }
+  return polyhedron;
+}
+
+int polyhedron_is_test_polyhedron(const Polyhedron *polyhedron) {
+  const int lengths[] = { 3, 4, inline_count + 3 };
+  if (polyhedron->length != 3) return 0;
+  for (int polygon_i = 0; polygon_i < 3; polygon_i++) {
+    if (!polygon_holds_test_points(Polyhedron_get(polyhedron, polygon_i), lengths[polygon_i], 10 * polygon_i)) return 0;
+  }
+  return 1;
+}
+
+void check_deep_clone(Arena *arena) {
+  const char *where = arena == NULL ? "heap" : "arena";
+  Polyhedron *original = test_polyhedron();
+  Polyhedron *clone = Polyhedron_deep_clone_in(original, arena);
+
+  CHECK(polyhedron_is_test_polyhedron(clone), "the clone's polygons are the original's (%s)", where);
+  for (int i = 0; i < 3; i++) {
+    const Polygon *polygon = Polyhedron_get(clone, i);
+    CHECK(polygon != Polyhedron_get(original, i), "clone polygon %d is its own (%s)", i, where);
+    CHECK(polygon->arena == arena, "clone polygon %d is in the clone's arena (%s)", i, where);
+  }
+  CHECK(Polyhedron_get(clone, 2)->spilled != Polyhedron_get(original, 2)->spilled,
+        "the clone's spilled points are its own (%s)", where);
+
+  // Changes to either don't reach the other
+  const _Mat shift = Mat_translate(1, 1, 1);
+  Polyhedron_transform(original, shift);
+  CHECK(polyhedron_is_test_polyhedron(clone), "the clone is unchanged by transforming the original (%s)", where);
+
+  Polyhedron_destroy(original);
+  original = test_polyhedron();
+  Polyhedron_transform(clone, shift);
+  Polygon_append(Polyhedron_get(clone, 0), test_point(0));
+  CHECK(polyhedron_is_test_polyhedron(original), "a fresh original is unchanged by changing the clone (%s)", where);
+
+  Polyhedron_destroy(original);
+  Polyhedron_destroy(clone);
+}
+
+int main() {
+  check_reset();
+  check_clone_in();
+  check_deep_clone(NULL);
+  Arena *arena = Arena_new(1 << 10);
+  check_deep_clone(arena);
+  Arena_destroy(arena);
+  return check_exit_code("arena");
+}
@@ -0,0 +1,52 @@
+#ifndef check_c_INCLUDED
+#define check_c_INCLUDED
+
+// Minimal checking for the tests in this directory
+//
+// CHECK reports a failed condition and carries on, so that one run shows
+// every failure; check_exit_code then gives the test's exit status.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+int check_failures = 0;
+
+#define CHECK(cond, ...) \
+  do { \
+    if (!(cond)) { \
+      check_failures++; \
+      printf("%s:%d: check failed: %s\n  ", __FILE__, __LINE__, #cond); \
+      printf(__VA_ARGS__); \
+      printf("\n"); \
+    } \
+  } while (0)
+
+int check_close(const float actual, const float expected, const float tolerance) {
+  /* Are the two within tolerance, relative to the larger of 1 and the expected value? */
+  const float scale = fabsf(expected) > 1 ? fabsf(expected) : 1;
+  return fabsf(actual - expected) <= tolerance * scale;
+}
+
+// Deterministic, so that failures reproduce
+unsigned int check_random_state = 1;
+
+float check_random(const float lo, const float hi) {
+  /* A pseudo-random float in [lo, hi) */
+  check_random_state ^= check_random_state << 13;
+  check_random_state ^= check_random_state >> 17;
+  check_random_state ^= check_random_state << 5;
+  return lo + (hi - lo) * (check_random_state / 4294967296.0f);
+}
+
+int check_exit_code(const char *name) {
+  if (check_failures == 0) {
+    printf("%s: ok\n", name);
+    return 0;
+  }
+  printf("%s: %d check(s) failed\n", name, check_failures);
+  return 1;
+}
+
+
+#endif // check_c_INCLUDED
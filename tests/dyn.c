@@ -0,0 +1,114 @@
+// Tests of inline lists (DYN_INIT_INLINE), which polygons are
+//
+// Polygons built on the heap and in an arena are checked alike. Those of
+// parametric polyhedra, which are what most models are made of, should all
+// have their points inline.
+
+#include <stdio.h>
+#include <math.h>
+
+#include "check.c"
+#include "../matrix.c"
+#include "../shapes/polyhedron.c"
+#include "../util/arena.c"
+
+// Points inline in every Polygon
+const int inline_count = sizeof(((Polygon*) NULL)->inline_items) / sizeof(v3);
+
+v3 test_point(const int i) {
+  return (v3) { i, 2 * i, 3 * i };
+}
+
+int points_equal(const v3 a, const v3 b) {
+  return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
+}
+
+int polygon_holds_test_points(const Polygon *polygon, const int count, const int offset) {
+  /* Does the polygon hold test points offset through offset + count - 1? */
+  if (polygon->length != count) return 0;
+  for (int i = 0; i < count; i++) {
+    if (!points_equal(Polygon_get(polygon, i), test_point(offset + i))) return 0;
+  }
+  return 1;
+}
+
+void check_spill(Arena *arena) {
+  const char *where = arena == NULL ? "heap" : "arena";
+  Polygon *polygon = Polygon_new_in(0, arena);
+
+  for (int i = 0; i < inline_count; i++) Polygon_append(polygon, test_point(i));
+  CHECK(polygon->spilled == NULL, "a full polygon is still inline (%s)", where);
+  CHECK(polygon_holds_test_points(polygon, inline_count, 0), "inline points (%s)", where);
+
+  const size_t arena_used = arena == NULL ? 0 : Arena_used(arena);
+  Polygon_append(polygon, test_point(inline_count));
+  CHECK(polygon->spilled != NULL, "one more point spills (%s)", where);
+  CHECK(polygon_holds_test_points(polygon, inline_count + 1, 0), "points kept on spilling (%s)", where);
+  if (arena != NULL) CHECK(Arena_used(arena) > arena_used, "spilled points are in the arena");
+
+  for (int i = inline_count + 1; i < 100; i++) Polygon_append(polygon, test_point(i));
+  CHECK(polygon_holds_test_points(polygon, 100, 0), "points kept while growing (%s)", where);
+  CHECK(polygon->size >= polygon->length, "size holds the length (%s)", where);
+
+  Polygon_set(polygon, 50, test_point(-1));
+  CHECK(points_equal(Polygon_get(polygon, 50), test_point(-1)), "setting a spilled point (%s)", where);
+
+  Polygon_clear(polygon);
+  CHECK(polygon->spilled == NULL, "a cleared polygon is inline (%s)", where);
+  CHECK(polygon->length == 0, "a cleared polygon is empty (%s)", where);
+
+  Polygon_append(polygon, test_point(7));
+  CHECK(polygon_holds_test_points(polygon, 1, 7), "appending after clearing (%s)", where);
+
+  // Shrinking a spilled polygon back inline keeps the points that fit
+  for (int i = 1; i < 20; i++) Polygon_append(polygon, test_point(7 + i));
+  Polygon_resize(polygon, inline_count);
+  CHECK(polygon->spilled == NULL, "resizing back to the inline count (%s)", where);
+  CHECK(polygon_holds_test_points(polygon, inline_count, 7), "points kept on shrinking (%s)", where);
+
+  Polygon_destroy(polygon);
+}
+
+void check_inline_copy() {
+  // An inline polygon may be copied bytewise, and the copy is independent
+  Polygon original;
+  Polygon_init(&original, 0);
+  for (int i = 0; i < 3; i++) Polygon_append(&original, test_point(i));
+
+  Polygon copy;
+  memcpy(&copy, &original, sizeof(Polygon));
+  Polygon_set(&original, 0, test_point(-1));
+  CHECK(polygon_holds_test_points(&copy, 3, 0), "a bytewise copy of an inline polygon is independent");
+}
+
+v3 test_parameterization(float t, float s) {
+  return (v3) { cos(t) * sin(s), sin(t) * sin(s), cos(s) };
+}
+
+void check_parametric() {
+  Polyhedron *polyhedron = Polyhedron_from_parametric(test_parameterization, 0, 2 * M_PI, 12, 1, 0, M_PI, 7, 1);
+  CHECK(polyhedron->length > 0, "the parametric polyhedron has no polygons");
+
+  int spilled = 0;
+  for (size_t i = 0; i < polyhedron->length; i++) {
+    const Polygon *polygon = Polyhedron_get(polyhedron, i);
+    if (polygon->spilled != NULL) spilled++;
+  }
+  CHECK(spilled == 0, "%d polygon(s) of a parametric polyhedron spilled", spilled);
+
+  // So they fit the pool which was sized for them
+  CHECK(polyhedron->arena->blocks->next == NULL, "a parametric polyhedron's pool took several blocks");
+
+  // It's freed with its pool
+  Arena_destroy(polyhedron->arena);
+}
+
+int main() {
+  check_spill(NULL);
+  Arena *arena = Arena_new(1 << 10);
+  check_spill(arena);
+  Arena_destroy(arena);
+  check_inline_copy();
+  check_parametric();
+  return check_exit_code("dyn");
+}
@@ -0,0 +1,202 @@
+// Tests of the matrix functions against plain scalar versions
+//
+// The scalar versions are the textbook definitions, written out here as
+// the triple loop and the adjugate over the determinant, which is what
+// matrix.c computed before it was vectorized. Each is compared on random
+// matrices: affine ones, rigid ones, and general ones with a full bottom row.
+
+#include <stdio.h>
+#include <math.h>
+
+#include "check.c"
+#include "../matrix.c"
+#include "../shapes/v3.c"
+
+// Matrices tried for each check
+const int trials = 10000;
+
+// Relative error allowed of results which are computed in a different order
+const float tolerance = 1e-4;
+
+void scalar_mult_M(_Mat result, const _Mat a, const _Mat b) {
+  /* result = a * b, one term at a time. result mustn't be a or b */
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) {
+      float sum = 0;
+      for (int k = 0; k < 4; k++) sum += a[i][k] * b[k][j];
+      result[i][j] = sum;
+    }
+  }
+}
+
+void scalar_inv_M(_Mat result, const _Mat m) {
+  /* The inverse by adjugate and determinant, for any invertible matrix */
+  Mat_adj_M(result, m);
+  Mat_scale(result, 1 / Mat_det(m));
+}
+
+void random_affine_M(_Mat result) {
+  /* A random affine matrix, kept well away from singular */
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 4; j++) result[i][j] = check_random(-1, 1);
+    result[i][i] += 3;
+  }
+  for (int j = 0; j < 4; j++) result[3][j] = j == 3;
+}
+
+void random_general_M(_Mat result) {
+  /* A random matrix whose bottom row isn't that of an affine transform */
+  random_affine_M(result);
+  for (int j = 0; j < 3; j++) result[3][j] = check_random(-.2, .2);
+  result[3][3] = check_random(2, 3);
+}
+
+void random_rigid_M(_Mat result) {
+  /* A random rotation followed by a random translation */
+  // The matrix macros use their arguments more than once, so each is found first
+  const float x_angle = check_random(-M_PI, M_PI);
+  const float y_angle = check_random(-M_PI, M_PI);
+  const float z_angle = check_random(-M_PI, M_PI);
+  const v3 offset = { check_random(-10, 10), check_random(-10, 10), check_random(-10, 10) };
+
+  const _Mat x_rot = Mat_x_rot(x_angle);
+  const _Mat y_rot = Mat_y_rot(y_angle);
+  const _Mat z_rot = Mat_z_rot(z_angle);
+  const _Mat translate = Mat_translate_v(offset);
+  Mat_chain_M(result, 4, x_rot, y_rot, z_rot, translate);
+}
+
+int matrices_close(const _Mat actual, const _Mat expected) {
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) {
+      if (!check_close(actual[i][j], expected[i][j], tolerance)) return 0;
+    }
+  }
+  return 1;
+}
+
+void check_mult() {
+  for (int trial = 0; trial < trials; trial++) {
+    _Mat a, b, expected, result;
+    random_general_M(a);
+    random_general_M(b);
+    scalar_mult_M(expected, a, b);
+
+    Mat_mult_M(result, a, b);
+    CHECK(matrices_close(result, expected), "Mat_mult_M, trial %d", trial);
+
+    // Aliased arguments
+    _Mat aliased;
+    Mat_clone_M(aliased, a);
+    Mat_mult_M(aliased, aliased, b);
+    CHECK(matrices_close(aliased, expected), "Mat_mult_M into its first argument, trial %d", trial);
+
+    Mat_clone_M(aliased, b);
+    Mat_mult_M(aliased, a, aliased);
+    CHECK(matrices_close(aliased, expected), "Mat_mult_M into its second argument, trial %d", trial);
+
+    Mat_clone_M(aliased, b);
+    Mat_then_M(aliased, a);
+    CHECK(matrices_close(aliased, expected), "Mat_then_M, trial %d", trial);
+
+    scalar_mult_M(expected, a, a);
+    Mat_clone_M(aliased, a);
+    Mat_mult_M(aliased, aliased, aliased);
+    CHECK(matrices_close(aliased, expected), "Mat_mult_M squaring in place, trial %d", trial);
+  }
+}
+
+void check_chain() {
+  for (int trial = 0; trial < trials; trial++) {
+    _Mat a, b, c, ba, expected, result;
+    random_affine_M(a);
+    random_general_M(b);
+    random_affine_M(c);
+    scalar_mult_M(ba, b, a);
+    scalar_mult_M(expected, c, ba);
+
+    Mat_chain_M(result, 3, a, b, c);
+    CHECK(matrices_close(result, expected), "Mat_chain_M, trial %d", trial);
+  }
+
+  const _Mat id = Mat_identity();
+  _Mat result;
+  Mat_chain_M(result, 0);
+  CHECK(matrices_close(result, id), "Mat_chain_M of nothing is the identity");
+}
+
+void check_inverses() {
+  for (int trial = 0; trial < trials; trial++) {
+    _Mat m, expected, result;
+
+    random_affine_M(m);
+    scalar_inv_M(expected, m);
+    Mat_inv_affine_M(result, m);
+    CHECK(matrices_close(result, expected), "Mat_inv_affine_M, trial %d", trial);
+    Mat_inv_M(result, m);
+    CHECK(matrices_close(result, expected), "Mat_inv_M of an affine matrix, trial %d", trial);
+
+    Mat_clone_M(result, m);
+    Mat_inv_affine_M(result, result);
+    CHECK(matrices_close(result, expected), "Mat_inv_affine_M in place, trial %d", trial);
+
+    random_rigid_M(m);
+    scalar_inv_M(expected, m);
+    Mat_inv_rigid_M(result, m);
+    CHECK(matrices_close(result, expected), "Mat_inv_rigid_M, trial %d", trial);
+
+    Mat_clone_M(result, m);
+    Mat_inv_rigid_M(result, result);
+    CHECK(matrices_close(result, expected), "Mat_inv_rigid_M in place, trial %d", trial);
+
+    random_general_M(m);
+    scalar_inv_M(expected, m);
+    Mat_inv_M(result, m);
+    CHECK(matrices_close(result, expected), "Mat_inv_M of a general matrix, trial %d", trial);
+  }
+}
+
+void check_normal() {
+  for (int trial = 0; trial < trials; trial++) {
+    _Mat m, inverse, expected, result;
+    random_affine_M(m);
+
+    // The inverse transpose, less any translation
+    scalar_inv_M(inverse, m);
+    for (int i = 0; i < 4; i++) {
+      for (int j = 0; j < 4; j++) {
+        expected[i][j] = i < 3 && j < 3 ? inverse[j][i] : i == j;
+      }
+    }
+
+    Mat_normal_M(result, m);
+    CHECK(matrices_close(result, expected), "Mat_normal_M, trial %d", trial);
+
+    Mat_clone_M(result, m);
+    Mat_normal_M(result, result);
+    CHECK(matrices_close(result, expected), "Mat_normal_M in place, trial %d", trial);
+  }
+}
+
+void check_transform() {
+  for (int trial = 0; trial < trials; trial++) {
+    _Mat m;
+    random_affine_M(m);
+    const v3 point = { check_random(-10, 10), check_random(-10, 10), check_random(-10, 10) };
+
+    const v3 result = v3_transform(point, m);
+    for (int i = 0; i < 3; i++) {
+      const float expected = m[i][0] * point[0] + m[i][1] * point[1] + m[i][2] * point[2] + m[i][3];
+      CHECK(check_close(result[i], expected, tolerance), "v3_transform, coordinate %d, trial %d", i, trial);
+    }
+  }
+}
+
+int main() {
+  check_mult();
+  check_chain();
+  check_inverses();
+  check_normal();
+  check_transform();
+  return check_exit_code("matrix");
+}
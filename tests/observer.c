@@ -0,0 +1,172 @@
+// Tests of the eye-space matrix (rendering/observer.c)
+//
+// calc_eyespace_matrix_M builds the matrix from an orthonormal basis. It's
+// compared with the construction it replaced, which rotated a copy of the
+// observer by three atan2 angles until it looked down +z with its up point
+// above it. That one is unstable when the observer looks straight up or
+// down, and undefined when its up point is in line with its interest, so
+// those poses are instead checked for what any eye-space matrix must do.
+
+#include <stdio.h>
+#include <math.h>
+
+#include "check.c"
+#include "../matrix.c"
+#include "../rendering/observer.c"
+
+// Relative error allowed between the two constructions
+const float tolerance = 1e-3;
+
+void atan2_eyespace_matrix_M(_Mat result, const Observer *ob) {
+  /* The eye-space matrix as it was found before it was built from a basis */
+
+  // Local copy of observer
+  Observer clone;
+  memcpy(&clone, ob, sizeof(Observer));
+
+  // Move the observer to the origin
+  _Mat observer_to_origin = Mat_translate_v(-ob->position);
+  Observer_transform(&clone, observer_to_origin);
+
+  // Rotate observer so that the interest is on the y-z plane
+  const float theta1 = -atan2(clone.interest[0], clone.interest[2]);
+  const _Mat align_interest_1 = Mat_y_rot(theta1);
+  Observer_transform(&clone, align_interest_1);
+
+  // Rotate observer so that the interest is on the z-axis
+  const float theta2 = +atan2(clone.interest[1], clone.interest[2]);
+  const _Mat align_interest_2 = Mat_x_rot(theta2);
+  Observer_transform(&clone, align_interest_2);
+
+  // Rotate observer so that the up point is on the y-z plane
+  const float theta3 = +atan2(clone.up_point[0], clone.up_point[1]);
+  const _Mat align_up_point = Mat_z_rot(theta3);
+
+  Mat_chain_M(
+    result, 4,
+    observer_to_origin,
+    align_interest_1,
+    align_interest_2,
+    align_up_point
+  );
+}
+
+v3 random_v3(const float lo, const float hi) {
+  return (v3) { check_random(lo, hi), check_random(lo, hi), check_random(lo, hi) };
+}
+
+int matrices_close(const _Mat actual, const _Mat expected) {
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) {
+      if (!check_close(actual[i][j], expected[i][j], tolerance)) return 0;
+    }
+  }
+  return 1;
+}
+
+void check_generic_poses() {
+  Observer *ob = Observer_new();
+
+  int trial = 0;
+  while (trial < 10000) {
+    const v3 position = random_v3(-10, 10);
+    const v3 view = random_v3(-5, 5);
+    const v3 up = random_v3(-5, 5);
+
+    // Away from the poles and from an up point in line with the interest
+    if (v3_mag(view) < .5 || fabs(view[1]) > .95 * v3_mag(view)) continue;
+    if (v3_mag(v3_cross(up, view)) < .1 * v3_mag(up) * v3_mag(view)) continue;
+    trial++;
+
+    ob->position = position;
+    ob->interest = position + view;
+    ob->up_point = position + up;
+    ob->eyespace_stale = 1;
+
+    _Mat actual, expected;
+    calc_eyespace_matrix_M(actual, ob);
+    atan2_eyespace_matrix_M(expected, ob);
+    CHECK(matrices_close(actual, expected), "basis and atan2 matrices differ, trial %d", trial);
+
+    // Moving the observer invalidates the cached matrix
+    const _Mat shift = Mat_translate(1, 2, 3);
+    Observer_transform(ob, shift);
+    calc_eyespace_matrix_M(actual, ob);
+    atan2_eyespace_matrix_M(expected, ob);
+    CHECK(matrices_close(actual, expected), "stale matrix used after moving the observer, trial %d", trial);
+  }
+
+  Observer_destroy(ob);
+}
+
+void check_eyespace_matrix(const _Mat m, const Observer *ob, const char *what) {
+  /* Check that m is a rotation and translation taking the observer to the origin, looking down +z */
+  int finite = 1;
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) finite &= isfinite(m[i][j]);
+  }
+  CHECK(finite, "%s: the matrix isn't finite", what);
+
+  // Its rows are the eye-space axes, orthonormal and right-handed like the generic ones
+  const v3 x_axis = { m[0][0], m[0][1], m[0][2] };
+  const v3 y_axis = { m[1][0], m[1][1], m[1][2] };
+  const v3 z_axis = { m[2][0], m[2][1], m[2][2] };
+  CHECK(check_close(v3_mag(x_axis), 1, tolerance) && check_close(v3_mag(y_axis), 1, tolerance) && check_close(v3_mag(z_axis), 1, tolerance),
+        "%s: the axes aren't unit length", what);
+  CHECK(fabs(v3_dot(x_axis, y_axis)) < tolerance && fabs(v3_dot(y_axis, z_axis)) < tolerance && fabs(v3_dot(z_axis, x_axis)) < tolerance,
+        "%s: the axes aren't perpendicular", what);
+  CHECK(check_close(v3_dot(v3_cross(y_axis, z_axis), x_axis), 1, tolerance), "%s: the axes are left-handed", what);
+
+  const v3 position = v3_transform(ob->position, m);
+  CHECK(v3_mag(position) < tolerance * (1 + v3_mag(ob->position)), "%s: the observer isn't taken to the origin", what);
+
+  const v3 interest = v3_transform(ob->interest, m);
+  CHECK(interest[2] > 0 && fabs(interest[0]) < tolerance * interest[2] && fabs(interest[1]) < tolerance * interest[2],
+        "%s: the interest isn't taken onto +z", what);
+}
+
+void check_degenerate_poses() {
+  Observer *ob = Observer_new();
+  const float up_distances[] = { 2, -3, .5, 0 };
+
+  for (int trial = 0; trial < 1000; trial++) {
+    const v3 position = random_v3(-10, 10);
+    v3 view = random_v3(-5, 5);
+    // Some straight along the world y axis, where the atan2 angles broke down
+    if (trial % 4 == 0) view = (v3) { 0, trial % 8 == 0 ? 3 : -3, 0 };
+    if (v3_mag(view) < .5) continue;
+
+    // The up point in line with the interest, ahead, behind, or at the observer
+    const float up_distance = up_distances[trial % 4];
+    ob->position = position;
+    ob->interest = position + view;
+    ob->up_point = position + up_distance * view;
+    ob->eyespace_stale = 1;
+
+    _Mat m;
+    calc_eyespace_matrix_M(m, ob);
+    char what[64];
+    snprintf(what, sizeof(what), "up point %g times the view away, trial %d", up_distance, trial);
+    check_eyespace_matrix(m, ob, what);
+
+    // Looking straight along y, with a proper up point
+    if (trial % 4 == 0) {
+      ob->up_point = position + (v3) { 0, 0, 1 };
+      ob->eyespace_stale = 1;
+      calc_eyespace_matrix_M(m, ob);
+      snprintf(what, sizeof(what), "looking along y, trial %d", trial);
+      check_eyespace_matrix(m, ob, what);
+
+      const v3 up = v3_transform(ob->up_point, m);
+      CHECK(up[1] > 0 && fabs(up[0]) < tolerance, "looking along y, trial %d: the up point isn't taken above the eye", trial);
+    }
+  }
+
+  Observer_destroy(ob);
+}
+
+int main() {
+  check_generic_poses();
+  check_degenerate_poses();
+  return check_exit_code("observer");
+}
@@ -0,0 +1,198 @@
+// Tests of the work-stealing thread pool (util/pool.c)
+//
+// The pool takes its worker count from POOL_WORKERS when it starts, once
+// per process, so each count is tested in a child process of its own: one
+// worker, where everything runs inline, and several, where tasks are stolen.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "check.c"
+#include "../util/pool.c"
+
+#define MAX_RANGE 10000
+
+// How many times each index was visited
+atomic_int visits[MAX_RANGE];
+
+typedef struct {
+  int grain;
+  // Subranges bigger than the grain allows
+  atomic_int oversized;
+} VisitLoop;
+
+void visit_body(void *arg, const int lo, const int hi) {
+  VisitLoop *loop = arg;
+  if (loop->grain > 0 && hi - lo > loop->grain) atomic_fetch_add(&loop->oversized, 1);
+  for (int i = lo; i < hi; i++) atomic_fetch_add(&visits[i], 1);
+}
+
+void check_parallel_for(const int lo, const int hi, const int grain) {
+  for (int i = 0; i < MAX_RANGE; i++) atomic_store(&visits[i], 0);
+
+  VisitLoop loop = { grain };
+  atomic_init(&loop.oversized, 0);
+  parallel_for(lo, hi, grain, visit_body, &loop);
+
+  int wrong = 0;
+  for (int i = 0; i < MAX_RANGE; i++) {
+    const int expected = lo <= i && i < hi;
+    if (atomic_load(&visits[i]) != expected) wrong++;
+  }
+  CHECK(wrong == 0, "parallel_for over [%d, %d) with grain %d: %d index(es) not visited exactly once", lo, hi, grain, wrong);
+  CHECK(atomic_load(&loop.oversized) == 0, "parallel_for over [%d, %d) with grain %d: subranges over the grain", lo, hi, grain);
+}
+
+// == Nesting ==
+
+atomic_int tree_nodes;
+
+void tree_task(void *arg, const int depth, const int unused) {
+  /* Count this node, then spawn and wait on its children */
+  atomic_fetch_add(&tree_nodes, 1);
+  if (depth == 0) return;
+
+  TaskGroup children;
+  TaskGroup_init(&children);
+  for (int i = 0; i < 4; i++) TaskGroup_spawn_range(&children, tree_task, NULL, depth - 1, 0);
+  TaskGroup_wait(&children);
+
+  // All of them ran before the wait returned
+  CHECK(atomic_load(&children.pending) == 0, "children of a depth-%d node still pending", depth);
+}
+
+atomic_int nested_visits;
+
+void nested_inner_body(void *arg, const int lo, const int hi) {
+  atomic_fetch_add(&nested_visits, hi - lo);
+}
+
+void nested_outer_body(void *arg, const int lo, const int hi) {
+  for (int i = lo; i < hi; i++) parallel_for(0, 100, 7, nested_inner_body, NULL);
+}
+
+void check_nesting() {
+  atomic_store(&tree_nodes, 0);
+  TaskGroup root;
+  TaskGroup_init(&root);
+  TaskGroup_spawn_range(&root, tree_task, NULL, 5, 0);
+  TaskGroup_wait(&root);
+  // 1 + 4 + ... + 4^5
+  CHECK(atomic_load(&tree_nodes) == 1365, "a tree of nested tasks ran %d nodes of 1365", atomic_load(&tree_nodes));
+
+  atomic_store(&nested_visits, 0);
+  parallel_for(0, 50, 1, nested_outer_body, NULL);
+  CHECK(atomic_load(&nested_visits) == 5000, "nested parallel_for visited %d indices of 5000", atomic_load(&nested_visits));
+}
+
+// == Isolation ==
+
+// With several workers, an isolated loop is made of two subranges. The
+// calling worker runs the first, which waits for another worker to steal the
+// second, then pushes tasks of another group, the decoys, onto its own deque.
+// A plain wait would take them from there while the second still runs.
+
+#define DECOY_COUNT 16
+
+// Set on the thread waiting on the loop
+_Thread_local int is_waiting_isolated = 0;
+
+TaskGroup decoys;
+atomic_int decoys_run;
+atomic_int interleaved;
+atomic_int second_started;
+atomic_int decoys_pushed;
+atomic_int isolated_visits;
+
+void decoy_task(void *arg, const int lo, const int hi) {
+  if (is_waiting_isolated) atomic_fetch_add(&interleaved, 1);
+  atomic_fetch_add(&decoys_run, 1);
+}
+
+void two_part_body(void *arg, const int lo, const int hi) {
+  if (lo == 0) {
+    while (!atomic_load(&second_started)) sched_yield();
+    for (int i = 0; i < DECOY_COUNT; i++) TaskGroup_spawn(&decoys, decoy_task, NULL);
+    atomic_store(&decoys_pushed, 1);
+  } else {
+    atomic_store(&second_started, 1);
+    // Still running once the decoys are there to be taken
+    while (!atomic_load(&decoys_pushed)) sched_yield();
+    usleep(10000);
+  }
+  atomic_fetch_add(&isolated_visits, hi - lo);
+}
+
+void isolated_inner_body(void *arg, const int lo, const int hi) {
+  usleep(50);
+  atomic_fetch_add(&isolated_visits, hi - lo);
+}
+
+void isolated_outer_body(void *arg, const int lo, const int hi) {
+  /* An isolated loop within a loop, as intersectors are drawn within layer jobs */
+  for (int i = lo; i < hi; i++) parallel_for_isolated(0, 16, 1, isolated_inner_body, NULL);
+}
+
+void check_isolation() {
+  if (pool_worker_count() > 1) {
+    atomic_store(&decoys_run, 0);
+    atomic_store(&interleaved, 0);
+    atomic_store(&second_started, 0);
+    atomic_store(&decoys_pushed, 0);
+    atomic_store(&isolated_visits, 0);
+    TaskGroup_init(&decoys);
+
+    is_waiting_isolated = 1;
+    parallel_for_isolated(0, 2, 1, two_part_body, NULL);
+    is_waiting_isolated = 0;
+    TaskGroup_wait(&decoys);
+
+    CHECK(atomic_load(&isolated_visits) == 2, "isolated loop visited %d indices of 2", atomic_load(&isolated_visits));
+    CHECK(atomic_load(&decoys_run) == DECOY_COUNT, "%d decoy(s) run of %d", atomic_load(&decoys_run), DECOY_COUNT);
+    CHECK(atomic_load(&interleaved) == 0, "%d decoy(s) run inside an isolated wait", atomic_load(&interleaved));
+  }
+
+  // Isolated loops in every worker at once still all finish
+  atomic_store(&isolated_visits, 0);
+  parallel_for(0, 32, 1, isolated_outer_body, NULL);
+  CHECK(atomic_load(&isolated_visits) == 32 * 16, "nested isolated loops visited %d indices of %d", atomic_load(&isolated_visits), 32 * 16);
+}
+
+int run_checks(const char *worker_count) {
+  setenv("POOL_WORKERS", worker_count, 1);
+  CHECK(pool_worker_count() == atoi(worker_count), "asked for %s workers, got %d", worker_count, pool_worker_count());
+
+  const int grains[] = { 0, 1, 3, 64, 1000, MAX_RANGE };
+  for (int i = 0; i < (int) (sizeof(grains) / sizeof(grains[0])); i++) {
+    check_parallel_for(0, MAX_RANGE, grains[i]);
+    check_parallel_for(17, 4711, grains[i]);
+    check_parallel_for(5, 6, grains[i]);
+    check_parallel_for(5, 5, grains[i]);
+  }
+
+  check_nesting();
+  check_isolation();
+
+  printf("with %s worker(s): ", worker_count);
+  return check_exit_code("pool");
+}
+
+int main() {
+  const char *worker_counts[] = { "1", "4" };
+  int status = 0;
+
+  for (int i = 0; i < 2; i++) {
+    fflush(stdout);
+    const pid_t child = fork();
+    if (child == 0) exit(run_checks(worker_counts[i]));
+
+    int child_status;
+    waitpid(child, &child_status, 0);
+    if (!WIFEXITED(child_status) || WEXITSTATUS(child_status) != 0) status = 1;
+  }
+
+  return status;
+}
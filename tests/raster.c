@@ -0,0 +1,214 @@
+// Tests of polygon filling by edge functions (rendering/raster.c)
+//
+// Polygons are made from the pixels their points should project to, and
+// filled with a zrecord, which Polygon_rasterize writes at every pixel it
+// covers. Counting those writes shows which pixels each polygon took, so
+// that polygons sharing edges can be checked to fill every pixel once.
+
+#include <stdio.h>
+#include <math.h>
+
+#include "check.c"
+#include "../state.c"
+#include "../matrix.c"
+#include "../shapes/figure.c"
+#include "../shapes/v2.c"
+#include "../rendering/raster.c"
+
+// Depth of every test polygon
+const float test_z = 10;
+
+// Unwritten pixels of the zrecord hold this
+const float unwritten = -1;
+
+Zbuf test_zbuf;
+Zbuf test_zrecord;
+
+// How many of the polygons filled so far covered each pixel
+int fill_counts[SCREEN_WIDTH][SCREEN_HEIGHT];
+
+void fill_counts_clear() {
+  for (int x = 0; x < SCREEN_WIDTH; x++) {
+    for (int y = 0; y < SCREEN_HEIGHT; y++) fill_counts[x][y] = 0;
+  }
+}
+
+Polygon *polygon_at_pixels(const int point_count, const v2 *pixels) {
+  /* A polygon whose points project to the given pixel coordinates */
+  Polygon *polygon = Polygon_new(point_count);
+  for (int i = 0; i < point_count; i++) Polygon_append(polygon, pixel_coords_inv_z(pixels[i], test_z));
+  return polygon;
+}
+
+int fill(const int point_count, const v2 *pixels) {
+  /* Rasterize a polygon, adding the pixels it covers to fill_counts.
+     Returns what Polygon_rasterize does */
+  Polygon *polygon = polygon_at_pixels(point_count, pixels);
+  zbuf_init(test_zbuf);
+  for (int x = 0; x < SCREEN_WIDTH; x++) {
+    for (int y = 0; y < SCREEN_HEIGHT; y++) test_zrecord[x][y] = unwritten;
+  }
+
+  const int result = Polygon_rasterize(polygon, test_zbuf, test_zrecord);
+
+  for (int x = 0; x < SCREEN_WIDTH; x++) {
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+      if (test_zrecord[x][y] != unwritten) fill_counts[x][y]++;
+    }
+  }
+
+  Polygon_destroy(polygon);
+  return result;
+}
+
+int filled_count() {
+  /* Number of pixels filled at least once */
+  int count = 0;
+  for (int x = 0; x < SCREEN_WIDTH; x++) {
+    for (int y = 0; y < SCREEN_HEIGHT; y++) count += fill_counts[x][y] > 0;
+  }
+  return count;
+}
+
+void check_tiling(const int (*whole_counts)[SCREEN_HEIGHT], const char *what) {
+  /* Check that fill_counts, from polygons tiling a whole, covers just what the whole did, once */
+  int overlaps = 0;
+  int holes = 0;
+  int strays = 0;
+  for (int x = 0; x < SCREEN_WIDTH; x++) {
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+      if (fill_counts[x][y] > 1) overlaps++;
+      if (fill_counts[x][y] == 0 && whole_counts[x][y] == 1) holes++;
+      if (fill_counts[x][y] > 0 && whole_counts[x][y] == 0) strays++;
+    }
+  }
+  CHECK(overlaps == 0, "%s: %d pixel(s) filled more than once", what, overlaps);
+  CHECK(holes == 0, "%s: %d pixel(s) of the whole left unfilled", what, holes);
+  CHECK(strays == 0, "%s: %d pixel(s) filled outside the whole", what, strays);
+}
+
+int whole_counts[SCREEN_WIDTH][SCREEN_HEIGHT];
+
+void save_whole() {
+  for (int x = 0; x < SCREEN_WIDTH; x++) {
+    for (int y = 0; y < SCREEN_HEIGHT; y++) whole_counts[x][y] = fill_counts[x][y];
+  }
+}
+
+void check_shared_diagonal() {
+  // Corners on pixel centers, so that the diagonal passes through a row of them
+  const v2 square[4] = { { 100, 100 }, { 200, 100 }, { 200, 200 }, { 100, 200 } };
+
+  fill_counts_clear();
+  CHECK(fill(4, square), "square not rasterized");
+  CHECK(filled_count() > 0, "square filled nothing");
+  save_whole();
+
+  // Both ways round, since the rule must not depend on winding
+  for (int reversed = 0; reversed <= 1; reversed++) {
+    v2 lower[3] = { square[0], square[1], square[2] };
+    v2 upper[3] = { square[0], square[2], square[3] };
+    if (reversed) {
+      const v2 swap = lower[0]; lower[0] = lower[2]; lower[2] = swap;
+      const v2 swap2 = upper[0]; upper[0] = upper[2]; upper[2] = swap2;
+    }
+
+    fill_counts_clear();
+    CHECK(fill(3, lower), "lower triangle not rasterized");
+    CHECK(fill(3, upper), "upper triangle not rasterized");
+    check_tiling(whole_counts, reversed ? "shared diagonal, reversed" : "shared diagonal");
+  }
+}
+
+void check_fan(const v2 center, const float radius, const int spoke_count, const int snap_to_pixels) {
+  /* Fill a convex polygon, then the fan of triangles from center to its edges */
+  v2 rim[spoke_count];
+  for (int i = 0; i < spoke_count; i++) {
+    const float angle = 2 * M_PI * i / spoke_count + check_random(0, .1);
+    rim[i] = center + radius * (v2) { cos(angle), sin(angle) };
+    if (snap_to_pixels) rim[i] = (v2) { round(rim[i][0]), round(rim[i][1]) };
+  }
+
+  fill_counts_clear();
+  CHECK(fill(spoke_count, rim), "rim not rasterized");
+  save_whole();
+
+  fill_counts_clear();
+  for (int i = 0; i < spoke_count; i++) {
+    const v2 triangle[3] = { center, rim[i], rim[(i + 1) % spoke_count] };
+    CHECK(fill(3, triangle), "triangle %d of the fan not rasterized", i);
+  }
+
+  char what[64];
+  snprintf(what, sizeof(what), "fan of %d around (%g, %g)", spoke_count, center[0], center[1]);
+  check_tiling(whole_counts, what);
+}
+
+void check_star() {
+  // A pentagram turns the same way at every point, but isn't convex
+  v2 star[5];
+  for (int i = 0; i < 5; i++) {
+    const float angle = 2 * M_PI * (2 * i) / 5;
+    star[i] = (v2) { 400 + 100 * cos(angle), 400 + 100 * sin(angle) };
+  }
+
+  Polygon *polygon = polygon_at_pixels(5, star);
+  int xs[5], ys[5];
+  CHECK(Polygon_snap_M(xs, ys, polygon), "star not snapped");
+  CHECK(!snapped_is_convex(xs, ys, 5), "star taken for convex");
+  Polygon_destroy(polygon);
+
+  fill_counts_clear();
+  CHECK(!fill(5, star), "star rasterized");
+  CHECK(filled_count() == 0, "rejected star filled %d pixel(s)", filled_count());
+
+  // Whereas the pentagon through the same points is convex
+  v2 pentagon[5];
+  for (int i = 0; i < 5; i++) pentagon[i] = star[i * 3 % 5];
+  polygon = polygon_at_pixels(5, pentagon);
+  CHECK(Polygon_snap_M(xs, ys, polygon), "pentagon not snapped");
+  CHECK(snapped_is_convex(xs, ys, 5), "pentagon taken for not convex");
+  Polygon_destroy(polygon);
+}
+
+void check_guard_band() {
+  // Reaching past the guard band, as only happens with clipping off
+  const v2 wide[3] = { { 100, 100 }, { RASTER_GUARD_BAND + 500, 200 }, { 100, 300 } };
+  fill_counts_clear();
+  CHECK(!fill(3, wide), "triangle beyond the guard band rasterized");
+  CHECK(filled_count() == 0, "triangle beyond the guard band filled %d pixel(s)", filled_count());
+
+  // Only just inside it, and still drawn, though mostly off the screen
+  const v2 inside[3] = { { 100, 100 }, { RASTER_GUARD_BAND - 10, 200 }, { 100, 300 } };
+  fill_counts_clear();
+  CHECK(fill(3, inside), "triangle inside the guard band not rasterized");
+  CHECK(filled_count() > 0, "triangle inside the guard band filled nothing");
+
+  // Behind the eye
+  Polygon *behind = Polygon_new(3);
+  Polygon_append(behind, (v3) { 0, 0, 5 });
+  Polygon_append(behind, (v3) { 1, 0, -5 });
+  Polygon_append(behind, (v3) { 0, 1, 5 });
+  zbuf_init(test_zbuf);
+  CHECK(!Polygon_rasterize(behind, test_zbuf, NULL), "triangle reaching behind the eye rasterized");
+  Polygon_destroy(behind);
+}
+
+int main() {
+  draw_update_constants();
+  draw_clip_reset();
+
+  check_shared_diagonal();
+
+  check_fan((v2) { 400, 400 }, 150, 12, 1);
+  check_fan((v2) { 400, 400 }, 150, 12, 0);
+  for (int trial = 0; trial < 20; trial++) {
+    const v2 center = { check_random(200, 600), check_random(200, 600) };
+    check_fan(center, check_random(5, 150), 3 + trial % 10, trial % 2);
+  }
+
+  check_star();
+  check_guard_band();
+
+  return check_exit_code("raster");
+}
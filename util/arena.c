@@ -0,0 +1,125 @@
+#ifndef arena_c_INCLUDED
+#define arena_c_INCLUDED
+
+// Bump allocator
+//
+// An arena hands out memory from large blocks by advancing an offset,
+// and frees all of it at once. It serves two purposes here:
+//  - Scratch memory which lives for one frame, in an arena which
+//    is reset every frame (see frame_arena in render.c)
+//  - A pool for geometry owned by one figure, which is
+//    released in one go when the figure is destroyed
+//
+// Functions taking an Arena* accept NULL to mean the heap,
+// so that the same code can allocate either way.
+
+#include <stdlib.h>
+#include <stddef.h>
+
+// Alignment of every allocation; enough for the vector types
+#define ARENA_ALIGN 16
+
+typedef struct ArenaBlock {
+  struct ArenaBlock *next;
+  // Capacity and usage of data, in bytes
+  size_t size;
+  size_t used;
+  _Alignas(ARENA_ALIGN) unsigned char data[];
+} ArenaBlock;
+
+typedef struct Arena {
+  // Blocks, newest first; allocations come from the newest
+  ArenaBlock *blocks;
+  // Capacity of the next block to be made
+  size_t block_size;
+} Arena;
+
+static ArenaBlock *ArenaBlock_new(const size_t size) {
+  ArenaBlock *block = malloc(sizeof(ArenaBlock) + size);
+
+#ifdef DEBUG
+  if (block == NULL) {
+    printf("arena block allocation failed\n");
+    exit(1);
+  }
+#endif
+
+  block->next = NULL;
+  block->size = size;
+  block->used = 0;
+  return block;
+}
+
+Arena *Arena_new(const size_t block_size) {
+  Arena *arena = malloc(sizeof(Arena));
+  arena->blocks = NULL;
+  arena->block_size = block_size < ARENA_ALIGN ? ARENA_ALIGN : block_size;
+  return arena;
+}
+
+void *Arena_alloc(Arena *arena, size_t bytes) {
+  /* Allocate some memory from the arena, or from the heap if the arena is NULL */
+  if (arena == NULL) return malloc(bytes);
+
+  bytes = (bytes + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+
+  ArenaBlock *block = arena->blocks;
+  if (block == NULL || block->size - block->used < bytes) {
+    // Blocks grow geometrically so that few are ever needed
+    while (arena->block_size < bytes) arena->block_size *= 2;
+    block = ArenaBlock_new(arena->block_size);
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->block_size *= 2;
+  }
+
+  void *result = block->data + block->used;
+  block->used += bytes;
+  return result;
+}
+
+void Arena_reset(Arena *arena) {
+  /* Free everything allocated from the arena, keeping its memory for reuse */
+
+  if (arena->blocks == NULL) return;
+
+  if (arena->blocks->next == NULL) {
+    arena->blocks->used = 0;
+    return;
+  }
+
+  // Replace several blocks by a single one which would have held them all,
+  // so that once the arena has seen its peak usage it never allocates again
+  size_t total = 0;
+  ArenaBlock *block = arena->blocks;
+  while (block != NULL) {
+    ArenaBlock *next = block->next;
+    total += block->size;
+    free(block);
+    block = next;
+  }
+
+  arena->blocks = ArenaBlock_new(total);
+  arena->block_size = 2 * total;
+}
+
+size_t Arena_used(const Arena *arena) {
+  /* Number of bytes allocated from the arena, including padding */
+  size_t used = 0;
+  for (const ArenaBlock *block = arena->blocks; block != NULL; block = block->next) {
+    used += block->used;
+  }
+  return used;
+}
+
+void Arena_destroy(Arena *arena) {
+  ArenaBlock *block = arena->blocks;
+  while (block != NULL) {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  free(arena);
+}
+
+#endif // arena_c_INCLUDED
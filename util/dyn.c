@@ -3,6 +3,10 @@
 
 // Generic variable-length list
 
+#include <string.h>
+
+#include "arena.c"
+
 // Set the macro DYN_TYPE to be the type of the list
 // then include this file and call DYN_INIT(NAME, TYPE)
 // For instance,
@@ -34,11 +38,24 @@ typedef struct Dyn {
   // (in multiples of type_size)
   size_t size;
 
+  // Where the dyn and its items were allocated;
+  // NULL for the heap. Memory in an arena is
+  // released with the arena, not by Dyn_destroy.
+  Arena *arena;
+
 } Dyn;
 
 
 static void Dyn_resize(Dyn *dyn, const size_t new_size) {
-  dyn->items = realloc(dyn->items, new_size * dyn->type_size);
+  if (dyn->arena == NULL) {
+    dyn->items = realloc(dyn->items, new_size * dyn->type_size);
+  } else {
+    // Arenas can't grow allocations in place; the old items stay until the arena goes
+    void *items = Arena_alloc(dyn->arena, new_size * dyn->type_size);
+    const size_t kept = dyn->length < new_size ? dyn->length : new_size;
+    memcpy(items, dyn->items, kept * dyn->type_size);
+    dyn->items = items;
+  }
   dyn->size = new_size;
 }
 
@@ -47,33 +64,61 @@ static void Dyn_clear(Dyn *dyn) {
   dyn->length = 0;
 }
 
-static void Dyn_init(Dyn *dyn, const size_t starting_size, const size_t type_size) {
+static void Dyn_init_in(Dyn *dyn, const size_t starting_size, const size_t type_size, Arena *arena) {
   dyn->type_size = type_size;
   dyn->starting_size = starting_size;
+  dyn->arena = arena;
 
   dyn->length = 0;
-  dyn->items = malloc(starting_size * dyn->type_size);
+  dyn->items = Arena_alloc(arena, starting_size * dyn->type_size);
   dyn->size = starting_size;
 }
 
-static Dyn *Dyn_new(const size_t starting_size, const size_t type_size) {
-  Dyn *dyn = malloc(sizeof(Dyn));
-  Dyn_init(dyn, starting_size, type_size);
+static void Dyn_init(Dyn *dyn, const size_t starting_size, const size_t type_size) {
+  Dyn_init_in(dyn, starting_size, type_size, NULL);
+}
+
+static Dyn *Dyn_new_in(const size_t starting_size, const size_t type_size, Arena *arena) {
+  Dyn *dyn = Arena_alloc(arena, sizeof(Dyn));
+  Dyn_init_in(dyn, starting_size, type_size, arena);
   return dyn;
 }
 
+static Dyn *Dyn_new(const size_t starting_size, const size_t type_size) {
+  return Dyn_new_in(starting_size, type_size, NULL);
+}
+
+static Dyn *Dyn_clone_in(const Dyn *dyn, Arena *arena) {
+  /* Copy a dyn and its items into an arena (or the heap). Items themselves are copied bytewise. */
+  Dyn *clone = Arena_alloc(arena, sizeof(Dyn));
+  memcpy(clone, dyn, sizeof(Dyn));
+  clone->arena = arena;
+  clone->items = Arena_alloc(arena, dyn->size * dyn->type_size);
+  memcpy(clone->items, dyn->items, dyn->length * dyn->type_size);
+  return clone;
+}
+
+static Dyn *Dyn_clone(const Dyn *dyn) {
+  return Dyn_clone_in(dyn, NULL);
+}
+
 static void Dyn_set_(Dyn *dyn, const size_t idx, const void *item) {
   /* Dyn_set with no checks */
   memcpy(dyn->items + idx * dyn->type_size, item, dyn->type_size);
 }
 
-static void Dyn_set(Dyn *dyn, const size_t idx, const void *item) {
 #ifdef DEBUG
-  if (idx < 0 || idx >= dyn->length) {
-    printf("dyn access out of bounds\n");
-    exit(1);
+#define DYN_CHECK_BOUNDS(dyn, idx) \
+  if ((idx) < 0 || (idx) >= (dyn)->length) { \
+    printf("dyn access out of bounds\n"); \
+    exit(1); \
   }
+#else
+#define DYN_CHECK_BOUNDS(dyn, idx)
 #endif
+
+static void Dyn_set(Dyn *dyn, const size_t idx, const void *item) {
+  DYN_CHECK_BOUNDS(dyn, idx);
   Dyn_set_(dyn, idx, item);
 }
 
@@ -96,18 +141,136 @@ static void Dyn_append(Dyn *dyn, void *item) {
  * the last line.
  */
 void Dyn_destroy(Dyn *dyn) {
+  if (dyn->arena != NULL) return;
   free(dyn->items);
   free(dyn);
 }
 
 #define DYN_INIT(NAME, TYPE) \
   typedef Dyn NAME; \
-  void NAME ## _init   (Dyn *dyn, const size_t starting_size ) { return Dyn_init(dyn, starting_size, sizeof(TYPE));     } \
-  Dyn* NAME ## _new    (const size_t starting_size           ) { return Dyn_new(starting_size, sizeof(TYPE));           } \
-  void NAME ## _resize (Dyn *dyn, const size_t new_size      ) { return Dyn_resize(dyn, new_size);                      } \
-  void NAME ## _clear  (Dyn *dyn                             ) { return Dyn_clear(dyn);                                 } \
-  void NAME ## _append (Dyn *dyn, TYPE item                  ) { return Dyn_append(dyn, &item);                         } \
-  TYPE NAME ## _get    (const Dyn *dyn, const size_t idx     ) { return *( (TYPE*) (dyn->items + idx * sizeof(TYPE)) ); } \
-  void NAME ## _set    (Dyn *dyn, const size_t idx, TYPE item) { return Dyn_set(dyn, idx, &item);                       } \
+  void NAME ## _init    (Dyn *dyn, const size_t starting_size              ) { return Dyn_init(dyn, starting_size, sizeof(TYPE));           } \
+  void NAME ## _init_in (Dyn *dyn, const size_t starting_size, Arena *arena) { return Dyn_init_in(dyn, starting_size, sizeof(TYPE), arena); } \
+  Dyn* NAME ## _new     (const size_t starting_size                        ) { return Dyn_new(starting_size, sizeof(TYPE));                 } \
+  Dyn* NAME ## _new_in  (const size_t starting_size, Arena *arena          ) { return Dyn_new_in(starting_size, sizeof(TYPE), arena);       } \
+  Dyn* NAME ## _clone   (const Dyn *dyn                                    ) { return Dyn_clone(dyn);                                       } \
+  Dyn* NAME ## _clone_in(const Dyn *dyn, Arena *arena                      ) { return Dyn_clone_in(dyn, arena);                             } \
+  void NAME ## _resize  (Dyn *dyn, const size_t new_size                   ) { return Dyn_resize(dyn, new_size);                            } \
+  void NAME ## _clear   (Dyn *dyn                                          ) { return Dyn_clear(dyn);                                       } \
+  void NAME ## _append  (Dyn *dyn, TYPE item                               ) { return Dyn_append(dyn, &item);                               } \
+  TYPE NAME ## _get     (const Dyn *dyn, const size_t idx                  ) { return *( (TYPE*) (dyn->items + idx * sizeof(TYPE)) );       } \
+  void NAME ## _set     (Dyn *dyn, const size_t idx, TYPE item             ) { return Dyn_set(dyn, idx, &item);                             } \
+
+
+// DYN_INIT_INLINE(NAME, TYPE, N) makes a list with the same interface as
+// DYN_INIT(NAME, TYPE), except that up to N items are stored in the list
+// itself and only longer lists use memory from the heap (or the arena).
+// The list is its own type rather than a Dyn, and its accessors are typed,
+// so they index directly instead of going through memcpy.
+//
+// Since the items are found through NAME_items() rather than a stored
+// pointer, lists may be copied bytewise. As with Dyn, a copy shares the
+// spilled items of the original, if there are any.
+//
+// Like Dyn_destroy, NAME_shallow_destroy frees only the list
+// and should be called last by the client's destroy method.
+
+#define DYN_INIT_INLINE(NAME, TYPE, N) \
+  typedef struct NAME { \
+    /* Items, once there are too many to store inline; otherwise NULL */ \
+    TYPE *spilled; \
+    /* Number of contained items */ \
+    size_t length; \
+    /* Capacity; never less than N */ \
+    size_t size; \
+    /* Where spilled items and the list itself were allocated; NULL for the heap */ \
+    Arena *arena; \
+    TYPE inline_items[N]; \
+  } NAME; \
+  \
+  static inline TYPE *NAME ## _items(const NAME *dyn) { \
+    return dyn->spilled == NULL ? (TYPE*) dyn->inline_items : dyn->spilled; \
+  } \
+  \
+  void NAME ## _resize(NAME *dyn, const size_t new_size) { \
+    TYPE *items = NAME ## _items(dyn); \
+    const size_t kept = dyn->length < new_size ? dyn->length : new_size; \
+    if (new_size <= (N)) { \
+      if (dyn->spilled != NULL) { \
+        memcpy(dyn->inline_items, items, kept * sizeof(TYPE)); \
+        if (dyn->arena == NULL) free(dyn->spilled); \
+        dyn->spilled = NULL; \
+      } \
+      dyn->size = (N); \
+    } else { \
+      if (dyn->spilled != NULL && dyn->arena == NULL) { \
+        dyn->spilled = realloc(dyn->spilled, new_size * sizeof(TYPE)); \
+      } else { \
+        TYPE *spilled = Arena_alloc(dyn->arena, new_size * sizeof(TYPE)); \
+        memcpy(spilled, items, kept * sizeof(TYPE)); \
+        dyn->spilled = spilled; \
+      } \
+      dyn->size = new_size; \
+    } \
+    dyn->length = kept; \
+  } \
+  \
+  void NAME ## _init_in(NAME *dyn, const size_t starting_size, Arena *arena) { \
+    dyn->length = 0; \
+    dyn->arena = arena; \
+    dyn->spilled = NULL; \
+    dyn->size = (N); \
+    if (starting_size > (N)) NAME ## _resize(dyn, starting_size); \
+  } \
+  \
+  void NAME ## _init(NAME *dyn, const size_t starting_size) { \
+    NAME ## _init_in(dyn, starting_size, NULL); \
+  } \
+  \
+  NAME *NAME ## _new_in(const size_t starting_size, Arena *arena) { \
+    NAME *dyn = Arena_alloc(arena, sizeof(NAME)); \
+    NAME ## _init_in(dyn, starting_size, arena); \
+    return dyn; \
+  } \
+  \
+  NAME *NAME ## _new(const size_t starting_size) { \
+    return NAME ## _new_in(starting_size, NULL); \
+  } \
+  \
+  NAME *NAME ## _clone_in(const NAME *dyn, Arena *arena) { \
+    /* Items themselves are copied bytewise */ \
+    NAME *clone = NAME ## _new_in(dyn->length, arena); \
+    memcpy(NAME ## _items(clone), NAME ## _items(dyn), dyn->length * sizeof(TYPE)); \
+    clone->length = dyn->length; \
+    return clone; \
+  } \
+  \
+  NAME *NAME ## _clone(const NAME *dyn) { \
+    return NAME ## _clone_in(dyn, NULL); \
+  } \
+  \
+  void NAME ## _clear(NAME *dyn) { \
+    NAME ## _resize(dyn, (N)); \
+    dyn->length = 0; \
+  } \
+  \
+  void NAME ## _append(NAME *dyn, TYPE item) { \
+    if (dyn->length == dyn->size) NAME ## _resize(dyn, 2 * dyn->size); \
+    NAME ## _items(dyn)[dyn->length++] = item; \
+  } \
+  \
+  static inline TYPE NAME ## _get(const NAME *dyn, const size_t idx) { \
+    return NAME ## _items(dyn)[idx]; \
+  } \
+  \
+  void NAME ## _set(NAME *dyn, const size_t idx, TYPE item) { \
+    DYN_CHECK_BOUNDS(dyn, idx); \
+    NAME ## _items(dyn)[idx] = item; \
+  } \
+  \
+  void NAME ## _shallow_destroy(NAME *dyn) { \
+    if (dyn->arena != NULL) return; \
+    free(dyn->spilled); \
+    free(dyn); \
+  } \
 
 #endif // dyn_c_INCLUDED
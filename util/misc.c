@@ -1,11 +1,49 @@
 #ifndef misc_c_INCLUDED
 #define misc_c_INCLUDED
 
+#include <math.h>
+#include <time.h>
+
 float sgn(float x) {
   if (x < 0) return -1;
   if (x > 0) return +1;
   return 0;
 }
 
-#endif // misc_c_INCLUDED
+float clamp(float x, float lo, float hi) {
+  if (x < lo) return lo;
+  if (x > hi) return hi;
+  return x;
+}
+
+double now_seconds() {
+  /* Monotonic wall-clock time, in seconds */
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void sleep_seconds(const double seconds) {
+  if (seconds <= 0) return;
+  struct timespec ts;
+  ts.tv_sec = (time_t) seconds;
+  ts.tv_nsec = (long) ((seconds - ts.tv_sec) * 1e9);
+  nanosleep(&ts, NULL);
+}
+
+int compare_doubles(const void *a, const void *b) {
+  /* Ascending comparator for qsort */
+  const double x = *(const double *) a;
+  const double y = *(const double *) b;
+  return (x > y) - (x < y);
+}
 
+double percentile(const double *sorted, const int count, const double p) {
+  /* Nearest-rank percentile of sorted values */
+  int idx = (int) ceil(p / 100 * count) - 1;
+  if (idx < 0) idx = 0;
+  if (idx > count - 1) idx = count - 1;
+  return sorted[idx];
+}
+
+#endif // misc_c_INCLUDED
@@ -0,0 +1,342 @@
+#ifndef pool_c_INCLUDED
+#define pool_c_INCLUDED
+
+// Work-stealing thread pool
+//
+// One pool of worker threads is shared by everything which wants to run
+// in parallel. Work is split into tasks, each of which belongs to a
+// TaskGroup which can be waited on. Each worker keeps its own tasks in a
+// Chase-Lev deque: it pushes and takes at the bottom, while idle workers
+// steal from the top of other workers' deques. Waiting on a group runs
+// tasks rather than blocking, so tasks may spawn and wait on tasks too.
+// A task which mustn't have others run in the middle of it, because they
+// could use the same per-worker state, waits in isolation instead, running
+// only tasks of the group it's waiting on.
+//
+// The thread which starts the pool (the first to use it) is worker 0.
+// Other threads may use the pool as well, but run their tasks inline.
+//
+// The number of workers is the number of CPUs, or the POOL_WORKERS
+// environment variable if it's set. With one worker, everything runs
+// inline on the calling thread.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#define POOL_MAX_WORKERS 32
+// Tasks each deque can hold; pushing to a full deque runs the task inline
+#define POOL_DEQUE_SIZE 4096
+// Failed attempts at finding work before an idle worker goes to sleep
+#define POOL_IDLE_SPINS 64
+
+typedef struct {
+  atomic_int pending;
+} TaskGroup;
+
+// A task runs fn(arg, lo, hi); lo and hi are for parallel_for's ranges
+typedef void (*TaskFn)(void *arg, int lo, int hi);
+
+typedef struct {
+  TaskFn fn;
+  void *arg;
+  int lo;
+  int hi;
+  TaskGroup *group;
+} Task;
+
+// A deque slot may be read by a thief while its owner writes it, in which case
+// the thief's CAS on top fails and it discards what it read. The fields are
+// atomic so that the read isn't a data race.
+typedef struct {
+  _Atomic(TaskFn) fn;
+  _Atomic(void *) arg;
+  atomic_int lo;
+  atomic_int hi;
+  _Atomic(TaskGroup *) group;
+} TaskSlot;
+
+typedef struct {
+  // Tasks are at indices top through bottom - 1, modulo POOL_DEQUE_SIZE
+  atomic_long top;
+  atomic_long bottom;
+  TaskSlot slots[POOL_DEQUE_SIZE];
+} TaskDeque;
+
+typedef struct {
+  int worker_count;
+  TaskDeque *deques;
+  pthread_t threads[POOL_MAX_WORKERS];
+
+  // Tasks pushed and not yet taken, to tell idle workers whether to sleep
+  atomic_int queued;
+  atomic_int sleeping;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+} Pool;
+
+Pool pool = { .worker_count = 0 };
+
+// Index of the calling thread in the pool, or -1 if it isn't a worker
+_Thread_local int pool_index = -1;
+
+static void TaskSlot_store(TaskSlot *slot, const Task task) {
+  atomic_store_explicit(&slot->fn, task.fn, memory_order_relaxed);
+  atomic_store_explicit(&slot->arg, task.arg, memory_order_relaxed);
+  atomic_store_explicit(&slot->lo, task.lo, memory_order_relaxed);
+  atomic_store_explicit(&slot->hi, task.hi, memory_order_relaxed);
+  atomic_store_explicit(&slot->group, task.group, memory_order_relaxed);
+}
+
+static Task TaskSlot_load(TaskSlot *slot) {
+  Task task;
+  task.fn = atomic_load_explicit(&slot->fn, memory_order_relaxed);
+  task.arg = atomic_load_explicit(&slot->arg, memory_order_relaxed);
+  task.lo = atomic_load_explicit(&slot->lo, memory_order_relaxed);
+  task.hi = atomic_load_explicit(&slot->hi, memory_order_relaxed);
+  task.group = atomic_load_explicit(&slot->group, memory_order_relaxed);
+  return task;
+}
+
+static int TaskDeque_push(TaskDeque *deque, const Task task) {
+  /* Push a task at the bottom. Owner only. Returns 0 if the deque is full */
+  const long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+  const long t = atomic_load_explicit(&deque->top, memory_order_acquire);
+  if (b - t >= POOL_DEQUE_SIZE) return 0;
+
+  TaskSlot_store(&deque->slots[b % POOL_DEQUE_SIZE], task);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+  return 1;
+}
+
+static int TaskDeque_take_M(TaskDeque *deque, Task *task) {
+  /* Take the task at the bottom. Owner only. Returns 0 if there was none */
+  const long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&deque->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+  if (t > b) {
+    atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+    return 0;
+  }
+
+  *task = TaskSlot_load(&deque->slots[b % POOL_DEQUE_SIZE]);
+  if (t < b) return 1;
+
+  // It's the last task, which a thief may be stealing too
+  const int won = atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+  atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+  return won;
+}
+
+static int TaskDeque_steal_M(TaskDeque *deque, Task *task) {
+  /* Steal the task at the top. Returns 0 if there was none or another thread got it */
+  long t = atomic_load_explicit(&deque->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  const long b = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+  if (t >= b) return 0;
+
+  *task = TaskSlot_load(&deque->slots[t % POOL_DEQUE_SIZE]);
+  return atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+}
+
+static void Task_run(const Task task) {
+  task.fn(task.arg, task.lo, task.hi);
+  atomic_fetch_sub_explicit(&task.group->pending, 1, memory_order_release);
+}
+
+static int pool_run_one() {
+  /* Run one task from this worker's deque, or else one stolen from another's.
+     Returns 0 if there was nothing to run */
+  Task task;
+  int found = TaskDeque_take_M(&pool.deques[pool_index], &task);
+
+  for (int i = 1; !found && i < pool.worker_count; i++) {
+    found = TaskDeque_steal_M(&pool.deques[(pool_index + i) % pool.worker_count], &task);
+  }
+
+  if (!found) return 0;
+  atomic_fetch_sub(&pool.queued, 1);
+  Task_run(task);
+  return 1;
+}
+
+static void *pool_worker_main(void *arg) {
+  pool_index = (int) (long) arg;
+
+  for (;;) {
+    int spins = 0;
+    while (spins < POOL_IDLE_SPINS) {
+      if (pool_run_one()) {
+        spins = 0;
+      } else {
+        spins++;
+        sched_yield();
+      }
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    atomic_fetch_add(&pool.sleeping, 1);
+    while (atomic_load(&pool.queued) == 0) pthread_cond_wait(&pool.wake, &pool.lock);
+    atomic_fetch_sub(&pool.sleeping, 1);
+    pthread_mutex_unlock(&pool.lock);
+  }
+
+  return NULL;
+}
+
+static int pool_default_worker_count() {
+  const char *env = getenv("POOL_WORKERS");
+  const long count = env != NULL ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+  if (count < 1) return 1;
+  if (count > POOL_MAX_WORKERS) return POOL_MAX_WORKERS;
+  return count;
+}
+
+void pool_start() {
+  /* Start the pool's workers, with the calling thread as worker 0. Idempotent */
+  if (pool.worker_count > 0) return;
+
+  pool.worker_count = pool_default_worker_count();
+  pool.deques = malloc(pool.worker_count * sizeof(TaskDeque));
+  for (int i = 0; i < pool.worker_count; i++) {
+    atomic_init(&pool.deques[i].top, 0);
+    atomic_init(&pool.deques[i].bottom, 0);
+  }
+
+  atomic_init(&pool.queued, 0);
+  atomic_init(&pool.sleeping, 0);
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.wake, NULL);
+
+  pool_index = 0;
+  for (long i = 1; i < pool.worker_count; i++) {
+    if (pthread_create(&pool.threads[i], NULL, pool_worker_main, (void *) i) != 0) {
+      // Make do with the workers there are
+      pool.worker_count = i;
+      break;
+    }
+  }
+}
+
+int pool_worker_count() {
+  pool_start();
+  return pool.worker_count;
+}
+
+int pool_worker_index() {
+  /* Index of the calling thread among the workers, or -1 if it isn't one */
+  return pool_index;
+}
+
+void TaskGroup_init(TaskGroup *group) {
+  atomic_init(&group->pending, 0);
+}
+
+void TaskGroup_spawn_range(TaskGroup *group, TaskFn fn, void *arg, const int lo, const int hi) {
+  /* Have fn(arg, lo, hi) run on some worker before group is done waiting */
+  const Task task = { fn, arg, lo, hi, group };
+  atomic_fetch_add_explicit(&group->pending, 1, memory_order_relaxed);
+
+  if (pool_index < 0 || pool.worker_count == 1 || !TaskDeque_push(&pool.deques[pool_index], task)) {
+    Task_run(task);
+    return;
+  }
+
+  atomic_fetch_add(&pool.queued, 1);
+  if (atomic_load(&pool.sleeping) > 0) {
+    pthread_mutex_lock(&pool.lock);
+    pthread_cond_signal(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+  }
+}
+
+void TaskGroup_spawn(TaskGroup *group, TaskFn fn, void *arg) {
+  TaskGroup_spawn_range(group, fn, arg, 0, 0);
+}
+
+void TaskGroup_wait(TaskGroup *group) {
+  /* Wait until every task spawned in the group has run, running tasks meanwhile */
+  while (atomic_load_explicit(&group->pending, memory_order_acquire) > 0) {
+    if (pool_index < 0 || !pool_run_one()) sched_yield();
+  }
+}
+
+void TaskGroup_wait_isolated(TaskGroup *group) {
+  /* Wait until every task spawned in the group has run, running only the group's tasks meanwhile */
+
+  // The group's tasks in this worker's deque were pushed after any others there, so
+  // they're taken first, and once a task of another group is taken none are left
+  int may_have_tasks = pool_index >= 0;
+
+  while (atomic_load_explicit(&group->pending, memory_order_acquire) > 0) {
+    Task task;
+    if (may_have_tasks && TaskDeque_take_M(&pool.deques[pool_index], &task)) {
+      if (task.group == group) {
+        atomic_fetch_sub(&pool.queued, 1);
+        Task_run(task);
+        continue;
+      }
+      TaskDeque_push(&pool.deques[pool_index], task);
+      may_have_tasks = 0;
+    }
+    sched_yield();
+  }
+}
+
+// == parallel_for ==
+
+typedef struct {
+  TaskFn body;
+  void *arg;
+  int grain;
+  TaskGroup group;
+} ParallelFor;
+
+static void parallel_for_task(void *arg, int lo, int hi) {
+  /* Give away the upper halves of the range until it's down to the grain size */
+  ParallelFor *loop = arg;
+  while (hi - lo > loop->grain) {
+    const int mid = lo + (hi - lo) / 2;
+    TaskGroup_spawn_range(&loop->group, parallel_for_task, loop, mid, hi);
+    hi = mid;
+  }
+  loop->body(loop->arg, lo, hi);
+}
+
+static void parallel_for_waiting(const int lo, const int hi, const int grain, TaskFn body, void *arg, const int is_isolated) {
+  if (hi <= lo) return;
+
+  ParallelFor loop;
+  loop.body = body;
+  loop.arg = arg;
+  loop.grain = grain > 0 ? grain : (hi - lo) / (4 * pool_worker_count());
+  if (loop.grain < 1) loop.grain = 1;
+  TaskGroup_init(&loop.group);
+
+  parallel_for_task(&loop, lo, hi);
+  if (is_isolated) {
+    TaskGroup_wait_isolated(&loop.group);
+  } else {
+    TaskGroup_wait(&loop.group);
+  }
+}
+
+void parallel_for(const int lo, const int hi, const int grain, TaskFn body, void *arg) {
+  /* Call body(arg, sub_lo, sub_hi) over subranges covering lo through hi - 1, in parallel.
+     Subranges have at most grain indices; if grain <= 0 it's chosen to give each worker
+     several subranges, so that the load can balance */
+  parallel_for_waiting(lo, hi, grain, body, arg, 0);
+}
+
+void parallel_for_isolated(const int lo, const int hi, const int grain, TaskFn body, void *arg) {
+  /* parallel_for, except that while the subranges run, the calling worker runs no other tasks */
+  parallel_for_waiting(lo, hi, grain, body, arg, 1);
+}
+
+#endif // pool_c_INCLUDED